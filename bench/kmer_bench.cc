@@ -0,0 +1,266 @@
+/**
+ * @file   kmer_bench.cc
+ *
+ * @brief Benchmark of the kmer_count_pairs phases on synthetic databases
+ *
+ * Generates an assembly and a read database with a given k, hash size
+ * and fraction of shared k-mers, in binary and text format, then
+ * times reading the headers, the merge, the histogram accumulation
+ * and the TSV output separately. Results are printed as TSV, one row
+ * per format and phase. Text databases are also read through the
+ * istream based jellyfish::text_reader (format text_istream), as a
+ * reference for the text parser.
+ *
+ */
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "kmer_count_pairs.hpp"
+
+static std::mt19937_64 rng(1);
+static uint64_t random_bits() { return rng(); }
+
+struct record {
+  uint64_t pos;
+  mer_dna  key;
+  uint64_t val;
+
+  bool operator<(const record& rhs) const { return pos != rhs.pos ? pos < rhs.pos : key < rhs.key; }
+  bool operator==(const record& rhs) const { return pos == rhs.pos && key == rhs.key; }
+};
+
+// Write the records, sorted by hash position, as a jellyfish
+// database. Binary records use a 4 byte counter, text records one
+// "mer count" line each.
+static void write_database(const std::string& path, std::vector<record>& records, const RectangularBinaryMatrix& m,
+                           size_t size, bool binary) {
+  std::sort(records.begin(), records.end());
+  records.erase(std::unique(records.begin(), records.end()), records.end());
+
+  const unsigned int max_reprobe = 126;
+  size_t             reprobes[max_reprobe + 1];
+  for(unsigned int i = 0; i <= max_reprobe; ++i)
+    reprobes[i] = i * (i + 1) / 2;
+  file_header header;
+  header.fill_standard();
+  header.size(size);
+  header.key_len(mer_dna::k() * 2);
+  header.val_len(7);
+  header.counter_len(4);
+  header.matrix(m);
+  header.max_reprobe(max_reprobe);
+  header.set_reprobes(reprobes);
+  header.format(binary ? binary_dumper::format : text_dumper::format);
+  {
+    std::ofstream os(path.c_str());
+    header.write(os);
+  }
+
+  const int fd = open_output(path, O_WRONLY | O_APPEND);
+  if(binary) {
+    binary_mer_writer writer(fd, header.key_len(), 4);
+    for(const auto& r : records)
+      writer.write(r.key, r.val);
+  } else {
+    tsv_writer  writer(fd);
+    std::string str;
+    for(const auto& r : records) {
+      str = r.key.to_str();
+      writer.put(str.c_str(), str.size(), ' ');
+      writer.put(r.val, '\n');
+    }
+  }
+}
+
+// Histogram that only counts the merged k-mers, to time the merge alone
+struct null_histogram {
+  struct shape { };
+  uint64_t nb_mers;
+
+  explicit null_histogram(const shape&) : nb_mers(0) { }
+  void add(const uint64_t*) { ++nb_mers; }
+  null_histogram& operator+=(const null_histogram& rhs) { nb_mers += rhs.nb_mers; return *this; }
+};
+
+// Histogram that records the count pairs, to replay them into a
+// coverage_histogram
+struct pair_recorder {
+  struct shape { };
+  std::vector<uint64_t> pairs;
+
+  explicit pair_recorder(const shape&) { }
+  void add(const uint64_t* counts) { pairs.push_back(counts[0]); pairs.push_back(counts[1]); }
+  pair_recorder& operator+=(const pair_recorder& rhs) {
+    pairs.insert(pairs.end(), rhs.pairs.begin(), rhs.pairs.end());
+    return *this;
+  }
+};
+
+static long peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+class timer {
+  std::chrono::steady_clock::time_point start_;
+
+public:
+  timer() : start_(std::chrono::steady_clock::now()) { }
+  double elapsed() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count(); }
+};
+
+static void report(const std::string& format, const char* phase, double seconds, uint64_t nb_mers) {
+  std::cout << format << '\t' << phase << '\t' << seconds << '\t' << nb_mers << '\t'
+            << (seconds > 0 ? nb_mers / seconds : 0) << '\t' << peak_rss_kb() << '\n';
+}
+
+template<typename reader_type>
+static void bench_format(const std::string& format, char* paths[], uint64_t nb_records, int nb_threads,
+                         const std::string& prefix) {
+  cpp_array<file_info> files(2);
+  timer                header_timer;
+  common_info          cinfo = read_headers(2, paths, files);
+  report(format, "read_headers", header_timer.elapsed(), 0);
+
+  discard_mers mers;
+  uint64_t     nb_mers;
+  {
+    merge_ranges<reader_type, null_histogram, discard_mers> merger(files, cinfo, mers, null_histogram::shape(),
+                                                                   nb_threads);
+    timer merge_timer;
+    merger.exec_join(nb_threads);
+    nb_mers = merger.reduce().nb_mers;
+    const double seconds = merge_timer.elapsed();
+    report(format, "merge", seconds, nb_mers);
+    report(format, "merge_records", seconds, nb_records);
+  }
+
+  const coverage_histogram::shape cap = { 1023, 10000 };
+  coverage_histogram              hist(cap);
+  {
+    merge_ranges<reader_type, pair_recorder, discard_mers> merger(files, cinfo, mers, pair_recorder::shape(),
+                                                                  nb_threads);
+    merger.exec_join(nb_threads);
+    const std::vector<uint64_t>& pairs = merger.reduce().pairs;
+    timer                        hist_timer;
+    for(size_t i = 0; i < pairs.size(); i += 2)
+      hist.add(pairs[i], pairs[i + 1]);
+    report(format, "histogram", hist_timer.elapsed(), nb_mers);
+  }
+
+  const output_config out = { prefix + "_" + format, cap, false, false, false };
+  timer               tsv_timer;
+  write_counts(hist, out);
+  report(format, "tsv", tsv_timer.elapsed(), nb_mers);
+
+  {
+    merge_ranges<reader_type, coverage_histogram, discard_mers> merger(files, cinfo, mers, cap, nb_threads);
+    timer total_timer;
+    merger.exec_join(nb_threads);
+    write_counts(merger.reduce(), out);
+    report(format, "total", total_timer.elapsed(), nb_mers);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const char* usage =
+    "kmer_bench [options]\n\n"
+    "Options:\n"
+    "\t-k/--mer-len\tk-mer length (31)\n"
+    "\t-s/--size\tlog2 of the hash size (24)\n"
+    "\t-n/--nb-mers\tk-mers per database (1000000)\n"
+    "\t-o/--overlap\tFraction of k-mers shared by the databases (0.5)\n"
+    "\t-t/--threads\tNumber of merge threads (1)\n"
+    "\t-d/--dir\tDirectory for the synthetic databases and outputs (.)\n"
+    "\t-h/--help\tPrint help message \n\n"
+    "Output columns: format, phase, seconds, k-mers, k-mers/s, peak RSS (KiB)\n";
+
+  unsigned int mer_len    = 31;
+  unsigned int size_log   = 24;
+  size_t       nb_mers    = 1000000;
+  double       overlap    = 0.5;
+  int          nb_threads = 1;
+  std::string  dir        = ".";
+  while (1) {
+    static struct option long_options[] = {
+      {"mer-len",  required_argument, 0, 'k' },
+      {"size",     required_argument, 0, 's' },
+      {"nb-mers",  required_argument, 0, 'n' },
+      {"overlap",  required_argument, 0, 'o' },
+      {"threads",  required_argument, 0, 't' },
+      {"dir",      required_argument, 0, 'd' },
+      {"help",     no_argument,       0, 'h' },
+      {0,          0,                 0, 0 }
+    };
+    int c = getopt_long(argc, argv, "k:s:n:o:t:d:h", long_options, 0);
+    if (c == -1)
+      break;
+    switch (c) {
+    case 'k': mer_len = atoi(optarg); break;
+    case 's': size_log = atoi(optarg); break;
+    case 'n': nb_mers = strtoull(optarg, 0, 10); break;
+    case 'o': overlap = atof(optarg); break;
+    case 't': nb_threads = std::max(1, atoi(optarg)); break;
+    case 'd': dir = optarg; break;
+    case 'h':
+      std::cout << usage;
+      return 0;
+    default:
+      err::die(err::msg() << usage);
+    }
+  }
+
+  mer_dna::k(mer_len);
+  const size_t            size = (size_t)1 << size_log;
+  RectangularBinaryMatrix m(size_log, 2 * mer_len);
+  m.randomize(random_bits);
+
+  // Assembly k-mers mostly have count 1, read k-mers a coverage peak
+  // with a long tail.
+  std::string bases(mer_len, 'A');
+  auto random_record = [&](bool assembly) {
+    record r;
+    for(auto& b : bases)
+      b = "ACGT"[rng() % 4];
+    r.key.from_chars(bases.c_str());
+    r.pos = m.times(r.key) & (size - 1);
+    r.val = assembly ? 1 + (rng() % 10 == 0) : 1 + rng() % 60 + (rng() % 100 == 0 ? rng() % 20000 : 0);
+    return r;
+  };
+  std::vector<record> assembly, reads;
+  for(size_t i = 0; i < nb_mers; ++i) {
+    assembly.push_back(random_record(true));
+    reads.push_back(std::uniform_real_distribution<double>()(rng) < overlap ? assembly.back() : random_record(false));
+    reads.back().val = random_record(false).val;
+  }
+
+  std::cout << "format\tphase\tseconds\tkmers\tkmers_per_sec\tpeak_rss_kb\n";
+  for(int binary = 1; binary >= 0; --binary) {
+    const std::string format   = binary ? "binary" : "text";
+    std::string       asm_path = dir + "/bench_assembly_" + format + ".jf";
+    std::string       rd_path  = dir + "/bench_reads_" + format + ".jf";
+    write_database(asm_path, assembly, m, size, binary);
+    write_database(rd_path, reads, m, size, binary);
+    char*          paths[]    = { &asm_path[0], &rd_path[0] };
+    const uint64_t nb_records = assembly.size() + reads.size();
+    if(binary) {
+      bench_format<binary_chunk_reader>(format, paths, nb_records, nb_threads, dir + "/bench");
+    } else {
+      bench_format<text_chunk_reader>(format, paths, nb_records, nb_threads, dir + "/bench");
+      bench_format<text_reader>("text_istream", paths, nb_records, nb_threads, dir + "/bench");
+    }
+  }
+  return 0;
+}
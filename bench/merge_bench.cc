@@ -0,0 +1,164 @@
+/**
+ * @file   merge_bench.cc
+ *
+ * @brief Microbenchmark of the k-way merge: mer_heap vs loser_tree
+ *
+ * Merges in memory sorted inputs, so only the merge engine is timed.
+ *
+ * Usage: merge_bench [records_per_input [k [overlap]]]
+ *
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <jellyfish/mer_dna.hpp>
+#include <jellyfish/mer_heap.hpp>
+
+#include "loser_tree.hpp"
+
+using jellyfish::mer_dna;
+
+struct record {
+  uint64_t pos;
+  mer_dna  key;
+  uint64_t val;
+};
+
+// Sorted in memory input with the reader interface
+class vector_reader {
+  const std::vector<record>* records_;
+  size_t                     i_;
+
+public:
+  explicit vector_reader(const std::vector<record>& records) : records_(&records), i_(0) { }
+  vector_reader() : records_(0), i_(0) { }
+
+  const mer_dna& key() const { return (*records_)[i_ - 1].key; }
+  const uint64_t& val() const { return (*records_)[i_ - 1].val; }
+  uint64_t pos() const { return (*records_)[i_ - 1].pos; }
+  bool next() { return ++i_ <= records_->size(); }
+};
+
+// Each input draws a fraction overlap of its records from a shared
+// pool, the rest are private, so keys repeat across inputs.
+static std::vector<std::vector<record>> make_inputs(size_t nb_inputs, size_t nb_records, double overlap) {
+  std::mt19937_64 rng(1);
+  const uint64_t  size = (uint64_t)1 << 32;
+  std::string     bases(mer_dna::k(), 'A');
+  auto random_record = [&]() {
+    record r;
+    r.pos = rng() % size;
+    for(auto& b : bases)
+      b = "ACGT"[rng() % 4];
+    r.key.from_chars(bases.c_str());
+    r.val = 1 + rng() % 100;
+    return r;
+  };
+  std::vector<record> shared;
+  for(size_t i = 0; i < nb_records; ++i)
+    shared.push_back(random_record());
+
+  std::vector<std::vector<record>> inputs(nb_inputs);
+  for(auto& input : inputs) {
+    for(size_t i = 0; i < nb_records; ++i)
+      input.push_back(std::uniform_real_distribution<double>()(rng) < overlap ? shared[i] : random_record());
+    std::sort(input.begin(), input.end(), [](const record& a, const record& b) {
+        return a.pos != b.pos ? a.pos < b.pos : a.key < b.key;
+      });
+    input.erase(std::unique(input.begin(), input.end(), [](const record& a, const record& b) {
+          return a.pos == b.pos && a.key == b.key;
+        }), input.end());
+  }
+  return inputs;
+}
+
+// The merge loop of kmer_count_pairs before the loser tree
+static uint64_t merge_heap(const std::vector<std::vector<record>>& inputs) {
+  typedef jellyfish::mer_heap::heap<mer_dna, vector_reader> heap_type;
+  const size_t               num_files = inputs.size();
+  std::vector<vector_reader> readers;
+  for(const auto& input : inputs)
+    readers.push_back(vector_reader(input));
+  heap_type heap(num_files);
+  for(auto& reader : readers)
+    if(reader.next())
+      heap.push(reader);
+
+  heap_type::const_item_t head = heap.head();
+  const vector_reader*    base = &readers[0];
+  mer_dna                 key;
+  std::vector<uint64_t>   counts(num_files);
+  uint64_t                check = 0;
+  while(heap.is_not_empty()) {
+    key = head->key_;
+    memset(counts.data(), '\0', sizeof(uint64_t) * num_files);
+    do {
+      counts[head->it_ - base] = head->val_;
+      heap.pop();
+      if(head->it_->next())
+        heap.push(*head->it_);
+      head = heap.head();
+    } while(head->key_ == key && heap.is_not_empty());
+    for(size_t i = 0; i < num_files; ++i)
+      check = check * 31 + counts[i];
+  }
+  return check;
+}
+
+static uint64_t merge_loser_tree(const std::vector<std::vector<record>>& inputs) {
+  const size_t               num_files = inputs.size();
+  std::vector<vector_reader> readers;
+  for(const auto& input : inputs)
+    readers.push_back(vector_reader(input));
+  loser_tree<mer_dna, vector_reader> tree(readers.data(), num_files);
+
+  mer_dna               key;
+  std::vector<uint64_t> counts(num_files);
+  uint64_t              check = 0;
+  while(tree.is_not_empty()) {
+    tree.pop(key, counts.data());
+    for(size_t i = 0; i < num_files; ++i)
+      check = check * 31 + counts[i];
+  }
+  return check;
+}
+
+template<typename F>
+static double time_merge(F merge, const std::vector<std::vector<record>>& inputs, uint64_t& check) {
+  const auto start = std::chrono::steady_clock::now();
+  check            = merge(inputs);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+  const size_t nb_records = argc > 1 ? strtoull(argv[1], 0, 10) : 1000000;
+  mer_dna::k(argc > 2 ? atoi(argv[2]) : 31);
+  const double overlap = argc > 3 ? atof(argv[3]) : 0.5;
+
+  std::cout << "inputs\trecords\tmer_heap_s\tloser_tree_s\tspeedup\n";
+  const size_t nb_inputs[] = { 2, 4, 8, 16 };
+  for(size_t n : nb_inputs) {
+    const auto inputs = make_inputs(n, nb_records, overlap);
+    size_t     total  = 0;
+    for(const auto& input : inputs)
+      total += input.size();
+    uint64_t heap_check, tree_check;
+    const double heap_time = time_merge(merge_heap, inputs, heap_check);
+    const double tree_time = time_merge(merge_loser_tree, inputs, tree_check);
+    if(heap_check != tree_check) {
+      std::cerr << "Merge results differ for " << n << " inputs\n";
+      return 1;
+    }
+    std::cout << n << '\t' << total << '\t' << heap_time << '\t' << tree_time << '\t'
+              << heap_time / tree_time << '\n';
+  }
+  return 0;
+}
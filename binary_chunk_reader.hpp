@@ -0,0 +1,101 @@
+/**
+ * @file   binary_chunk_reader.hpp
+ *
+ * @brief Read jellyfish binary records from a chunk_source
+ *
+ * Drop in replacement for jellyfish::binary_reader that decodes
+ * records straight from memory (a mapping of the database, or the
+ * buffers of a readahead thread) instead of going through an
+ * std::istream.
+ *
+ */
+#ifndef __KMER_UTILS_BINARY_CHUNK_READER_HPP__
+#define __KMER_UTILS_BINARY_CHUNK_READER_HPP__
+
+#include <endian.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <jellyfish/mer_dna.hpp>
+#include <jellyfish/file_header.hpp>
+#include <jellyfish/rectangular_binary_matrix.hpp>
+
+#include "chunk_source.hpp"
+
+// Reads the fixed size records of a jellyfish binary database from
+// the chunks of source, which starts on a record boundary. Records
+// may span chunks. Keys are decoded as mer_type, mer_dna or a
+// static_mer.
+template<typename mer_type>
+class basic_binary_chunk_reader {
+  std::unique_ptr<chunk_source>      source_;
+  const char*                        cur_;
+  const char*                        end_;
+  const size_t                       key_bytes_;
+  const size_t                       val_len_;
+  const size_t                       record_len_;
+  std::vector<char>                  carry_;
+  mer_type                           key_;
+  uint64_t                           val_;
+  jellyfish::RectangularBinaryMatrix m_;
+  const size_t                       size_mask_;
+
+  // Assemble the next record from the end of the current chunk and
+  // the start of the following one(s).
+  const char* straddle() {
+    size_t have = end_ - cur_;
+    if(have) // cur_ is null before the first chunk
+      memcpy(carry_.data(), cur_, have);
+    cur_ = end_;
+    while(have < record_len_) {
+      const char *begin, *end;
+      if(!source_->next(begin, end))
+        return 0;
+      const size_t take = std::min(record_len_ - have, (size_t)(end - begin));
+      memcpy(carry_.data() + have, begin, take);
+      have += take;
+      cur_  = begin + take;
+      end_  = end;
+    }
+    return carry_.data();
+  }
+
+public:
+  // Takes ownership of source
+  basic_binary_chunk_reader(chunk_source* source, jellyfish::file_header* header) :
+    source_(source), cur_(0), end_(0),
+    key_bytes_((header->key_len() + 7) / 8),
+    val_len_(header->counter_len()),
+    record_len_(key_bytes_ + val_len_),
+    carry_(record_len_),
+    key_(header->key_len() / 2),
+    val_(0),
+    m_(header->matrix()),
+    size_mask_(header->size() - 1)
+  { }
+
+  const mer_type& key() const { return key_; }
+  const uint64_t& val() const { return val_; }
+  size_t pos() const { return m_.times(key()) & size_mask_; }
+
+  bool next() {
+    const char* record = cur_;
+    if((size_t)(end_ - cur_) >= record_len_)
+      cur_ += record_len_;
+    else if(!(record = straddle()))
+      return false;
+    key_.data__()[key_.nb_words() - 1] = 0;
+    memcpy(key_.data__(), record, key_bytes_);
+    val_ = 0;
+    memcpy(&val_, record + key_bytes_, val_len_);
+    val_ = le64toh(val_); // Counters are read as little endian
+    return true;
+  }
+};
+
+typedef basic_binary_chunk_reader<jellyfish::mer_dna> binary_chunk_reader;
+
+#endif /* __KMER_UTILS_BINARY_CHUNK_READER_HPP__ */
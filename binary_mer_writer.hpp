@@ -0,0 +1,79 @@
+/**
+ * @file   binary_mer_writer.hpp
+ *
+ * @brief Buffered writer of jellyfish binary records
+ *
+ * Writes (key, value) records in the jellyfish binary format to a
+ * file descriptor, in the order they are given. Records written in
+ * hash position order after a binary/sorted file_header form a valid
+ * sorted database without going through a hash table.
+ *
+ */
+#ifndef __KMER_UTILS_BINARY_MER_WRITER_HPP__
+#define __KMER_UTILS_BINARY_MER_WRITER_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <jellyfish/mer_dna.hpp>
+
+#include "fd_io.hpp"
+
+class binary_mer_writer {
+  const int         fd_;
+  const size_t      key_bytes_;
+  const size_t      val_len_;
+  const uint64_t    max_val_; // Counts saturate at the largest value on val_len_ bytes
+  std::vector<char> buffer_;
+  size_t            used_;
+  uint64_t          nb_records_;
+
+  binary_mer_writer(const binary_mer_writer&);
+  binary_mer_writer& operator=(const binary_mer_writer&);
+
+public:
+  // Takes ownership of fd. key_len is in bits, val_len in bytes.
+  binary_mer_writer(int fd, unsigned int key_len, unsigned int val_len, size_t buffer_size = 1 << 20) :
+    fd_(fd), key_bytes_((key_len + 7) / 8), val_len_(val_len),
+    max_val_(val_len >= sizeof(uint64_t) ? ~(uint64_t)0 : ((uint64_t)1 << (8 * val_len)) - 1),
+    buffer_(buffer_size), used_(0), nb_records_(0)
+  { }
+
+  ~binary_mer_writer() {
+    flush();
+    close(fd_);
+  }
+
+  uint64_t nb_records() const { return nb_records_; }
+
+  // key is a mer_dna or a static_mer. val is stored little endian
+  // (jellyfish itself writes host byte order, the same on little endian
+  // hosts).
+  template<typename mer_type>
+  void write(const mer_type& key, uint64_t val) {
+    if(used_ + key_bytes_ + val_len_ > buffer_.size())
+      flush();
+    char* ptr = &buffer_[used_];
+    memcpy(ptr, key.data(), key_bytes_);
+    if(val > max_val_)
+      val = max_val_;
+    for(size_t i = 0; i < val_len_; ++i, val >>= 8)
+      ptr[key_bytes_ + i] = (char)(val & 0xff);
+    used_ += key_bytes_ + val_len_;
+    ++nb_records_;
+  }
+
+  void flush() {
+    write_fully(fd_, buffer_.data(), used_);
+    used_ = 0;
+  }
+
+  // Flush and sync to stable storage
+  void sync() {
+    flush();
+    sync_fully(fd_);
+  }
+};
+
+#endif /* __KMER_UTILS_BINARY_MER_WRITER_HPP__ */
@@ -0,0 +1,162 @@
+/**
+ * @file   checkpoint.hpp
+ *
+ * @brief Checkpoints of the ranges of a merge, to resume it
+ *
+ * Every range of the merge periodically saves the hash position up to
+ * which it has merged all k-mers, its counters and a snapshot of its
+ * histogram to its own file. The file is written aside and renamed
+ * over the previous checkpoint, so a run killed at any point leaves
+ * the last complete checkpoint of every range. A resumed run locates
+ * each range's resume position in the inputs, as for a range start.
+ *
+ * Format, all little endian uint64 after the magic:
+ *   "KMERCKPT" version nb_files begin end resume_pos distinct mers_records
+ *   records[nb_files] file_sizes[nb_files]
+ *   partial histogram (see partial_histogram.hpp)
+ *
+ */
+#ifndef __KMER_UTILS_CHECKPOINT_HPP__
+#define __KMER_UTILS_CHECKPOINT_HPP__
+
+#include <endian.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <jellyfish/err.hpp>
+
+#include "mapped_file.hpp"
+#include "le_writer.hpp"
+#include "partial_histogram.hpp"
+
+// Where and how often the merge checkpoints, and whether it resumes
+// from the checkpoints of an interrupted run
+struct checkpoint_config {
+  std::string prefix;   // Range t is checkpointed to prefix.ckpt.<t>
+  double      interval; // Seconds between checkpoints, 0 for none
+  bool        resume;
+
+  checkpoint_config() : interval(0), resume(false) { }
+
+  bool enabled() const { return interval > 0 || resume; }
+  std::string path(int id) const { return prefix + ".ckpt." + std::to_string(id); }
+
+  // Remove the checkpoints of the nb_ranges ranges, once all outputs
+  // (histograms and mer-file) are written
+  void remove(int nb_ranges) const {
+    if(!enabled())
+      return;
+    for(int t = 0; t < nb_ranges; ++t) {
+      unlink(path(t).c_str());
+      unlink((path(t) + ".tmp").c_str());
+    }
+  }
+};
+
+// Snapshot of the histogram of a range, as a partial histogram. Other
+// histogram types (benchmarks) can't be checkpointed.
+template<typename histogram_type>
+struct histogram_snapshot {
+  static void write(const histogram_type&, le_writer&) {
+    jellyfish::err::die("This histogram can't be checkpointed");
+  }
+  static void read(const partial_histogram_file&, histogram_type&) {
+    jellyfish::err::die("This histogram can't be checkpointed");
+  }
+};
+
+template<>
+struct histogram_snapshot<coverage_histogram> {
+  static void write(const coverage_histogram& hist, le_writer& out) { write_partial(hist, out); }
+  static void read(const partial_histogram_file& in, coverage_histogram& hist) { in.add_to(hist); }
+};
+
+template<>
+struct histogram_snapshot<joint_histogram> {
+  static void write(const joint_histogram& hist, le_writer& out) { write_partial(hist, out); }
+  static void read(const partial_histogram_file& in, joint_histogram& hist) { in.add_to(hist); }
+};
+
+// State of the range [begin, end) of the hash positions: the k-mers at
+// positions [begin, resume_pos) are merged.
+struct range_checkpoint {
+  static const uint64_t version      = 1;
+  static const size_t   state_words  = 7;
+
+  uint64_t              begin, end, resume_pos;
+  uint64_t              distinct;     // k-mers merged
+  uint64_t              mers_records; // Records written to the mers output
+  std::vector<uint64_t> records;      // Records read in each input
+  std::vector<uint64_t> file_sizes;   // Size of each input, to check a resume
+
+  static const char* magic() { return "KMERCKPT"; }
+
+  // Write atomically and durably to path, with a snapshot of hist: the
+  // data is synced before the rename, and the directory after it, so a
+  // crash leaves either the previous or this checkpoint, complete.
+  template<typename histogram_type>
+  void write(const std::string& path, const histogram_type& hist) const {
+    const std::string tmp = path + ".tmp";
+    {
+      le_writer out(tmp);
+      out.put_bytes(magic(), 8);
+      out.put(version);
+      out.put(records.size());
+      out.put(begin);
+      out.put(end);
+      out.put(resume_pos);
+      out.put(distinct);
+      out.put(mers_records);
+      out.put(records.data(), records.size());
+      out.put(file_sizes.data(), file_sizes.size());
+      histogram_snapshot<histogram_type>::write(hist, out);
+      out.sync();
+    }
+    if(rename(tmp.c_str(), path.c_str()) == -1)
+      jellyfish::err::die(jellyfish::err::msg() << "Failed to rename checkpoint '" << tmp << "'" << jellyfish::err::no);
+    sync_directory(path);
+  }
+
+  // Read the checkpoint at path and add its snapshot to hist. Returns
+  // false if there is no checkpoint.
+  template<typename histogram_type>
+  bool read(const std::string& path, histogram_type& hist) {
+    if(access(path.c_str(), F_OK) == -1)
+      return false;
+    size_t state_len;
+    {
+      mapped_file map(path.c_str());
+      auto word = [&](size_t i) {
+        uint64_t x;
+        memcpy(&x, map.base() + 8 + i * sizeof(uint64_t), sizeof(x));
+        return le64toh(x);
+      };
+      if(map.size() < 8 + (state_words + 1) * sizeof(uint64_t) || memcmp(map.base(), magic(), 8) || word(0) != version)
+        jellyfish::err::die(jellyfish::err::msg() << "Invalid checkpoint '" << path << "'");
+      const uint64_t nb_files = word(1);
+      state_len = 8 + (state_words + 2 * nb_files) * sizeof(uint64_t);
+      if(nb_files > 1024 || map.size() < state_len)
+        jellyfish::err::die(jellyfish::err::msg() << "Invalid checkpoint '" << path << "'");
+      begin        = word(2);
+      end          = word(3);
+      resume_pos   = word(4);
+      distinct     = word(5);
+      mers_records = word(6);
+      records.resize(nb_files);
+      file_sizes.resize(nb_files);
+      for(size_t i = 0; i < nb_files; ++i) {
+        records[i]    = word(state_words + i);
+        file_sizes[i] = word(state_words + nb_files + i);
+      }
+    }
+    histogram_snapshot<histogram_type>::read(partial_histogram_file(path, state_len), hist);
+    return true;
+  }
+};
+
+#endif /* __KMER_UTILS_CHECKPOINT_HPP__ */
@@ -0,0 +1,392 @@
+/**
+ * @file   chunk_source.hpp
+ *
+ * @brief Sources of consecutive byte chunks of an input database
+ *
+ * binary_chunk_reader decodes records from the chunks handed out by a
+ * chunk_source; the source decides how the bytes get into memory.
+ *
+ */
+#ifndef __KMER_UTILS_CHUNK_SOURCE_HPP__
+#define __KMER_UTILS_CHUNK_SOURCE_HPP__
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <jellyfish/err.hpp>
+
+class chunk_source {
+public:
+  virtual ~chunk_source() { }
+
+  // Next chunk of the input in [begin, end). The previous chunk is
+  // released and must not be accessed anymore. Returns false at the
+  // end of the input.
+  virtual bool next(const char*& begin, const char*& end) = 0;
+};
+
+// Sources count the bytes of input in an optional progress counter,
+// read by the progress reporter. A chunk is counted once the reader is
+// done with it, when it asks for the next one or destroys the source,
+// so the counter does not run ahead of the merge.
+inline void add_progress(std::atomic<uint64_t>* progress, uint64_t bytes) {
+  if(progress)
+    progress->fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// A region of a memory mapping, as a single chunk. With a progress
+// counter, as slices for the counter to move along.
+class mapped_chunk_source : public chunk_source {
+  static const size_t slice_size = 1 << 20;
+
+  const char*            begin_;
+  const char*            end_;
+  std::atomic<uint64_t>* progress_;
+  size_t                 pending_; // Size of the slice being read
+
+public:
+  mapped_chunk_source(const char* begin, const char* end, std::atomic<uint64_t>* progress = 0) :
+    begin_(begin), end_(end), progress_(progress), pending_(0)
+  { }
+
+  virtual ~mapped_chunk_source() { add_progress(progress_, pending_); }
+
+  virtual bool next(const char*& begin, const char*& end) {
+    add_progress(progress_, pending_);
+    pending_ = 0;
+    if(begin_ == end_)
+      return false;
+    begin    = begin_;
+    end      = progress_ ? begin_ + std::min((size_t)slice_size, (size_t)(end_ - begin_)) : end_;
+    begin_   = end;
+    pending_ = progress_ ? end - begin : 0;
+    return true;
+  }
+};
+
+// Wait with a short spin, then yield, then sleep, until ready()
+template<typename F>
+inline void wait_until(F ready) {
+  for(unsigned int i = 0; !ready(); ++i) {
+    if(i < 64)
+      continue;
+    if(i < 256)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+// Ring of nb_buffers large aligned buffers passed from one producer
+// thread to one consumer thread. The producer fills buffer
+// head % nb_buffers while the consumer reads buffer tail % nb_buffers;
+// the two indices form a lock free single producer single consumer
+// queue, so either side only waits when the other falls behind.
+class chunk_ring {
+public:
+  static const size_t alignment  = 4096;
+  static const int    nb_buffers = 4;
+
+private:
+  struct buffer {
+    char*    data;
+    size_t   len;
+    bool     last;
+    uint64_t input_pos;
+  };
+
+  const size_t          buffer_size_;
+  buffer                buffers_[nb_buffers];
+  std::atomic<uint64_t> head_;    // Buffers filled by the producer
+  std::atomic<uint64_t> tail_;    // Buffers released by the consumer
+  std::atomic<bool>     done_;    // Producer reached end
+  std::atomic<bool>     stop_;    // Consumer is going away
+  bool                  holding_; // Consumer holds buffer tail_
+
+  chunk_ring(const chunk_ring&);
+  chunk_ring& operator=(const chunk_ring&);
+
+public:
+  explicit chunk_ring(size_t buffer_size) :
+    buffer_size_((buffer_size + alignment - 1) / alignment * alignment),
+    head_(0), tail_(0), done_(false), stop_(false), holding_(false)
+  {
+    for(int i = 0; i < nb_buffers; ++i) {
+      void* ptr;
+      if(posix_memalign(&ptr, alignment, buffer_size_))
+        throw std::bad_alloc();
+      buffers_[i].data = (char*)ptr;
+      buffers_[i].len  = 0;
+      buffers_[i].last = false;
+      buffers_[i].input_pos = 0;
+    }
+  }
+
+  ~chunk_ring() {
+    for(int i = 0; i < nb_buffers; ++i)
+      free(buffers_[i].data);
+  }
+
+  size_t buffer_size() const { return buffer_size_; }
+
+  // Producer side. Buffer of buffer_size() bytes to fill, or 0 if the
+  // consumer went away.
+  char* acquire() {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    wait_until([&]() {
+        return stop_.load(std::memory_order_relaxed) || head - tail_.load(std::memory_order_acquire) < nb_buffers;
+      });
+    return stop_.load(std::memory_order_relaxed) ? 0 : buffers_[head % nb_buffers].data;
+  }
+
+  // Hand the first len bytes of the acquired buffer to the consumer.
+  // last marks the end of a unit of the producer (see
+  // decompress_source), input_pos is how far in its input the
+  // producer is after this buffer.
+  void publish(size_t len, bool last = false, uint64_t input_pos = 0) {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    buffers_[head % nb_buffers].len       = len;
+    buffers_[head % nb_buffers].last      = last;
+    buffers_[head % nb_buffers].input_pos = input_pos;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // No more buffers
+  void close() { done_.store(true, std::memory_order_release); }
+
+  // Consumer side. Release the buffer held and wait for the next one.
+  // Returns false once the producer closed the ring.
+  bool next(const char*& begin, const char*& end, bool& last) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if(holding_) {
+      tail_.store(++tail, std::memory_order_release);
+      holding_ = false;
+    }
+    wait_until([&]() {
+        return head_.load(std::memory_order_acquire) > tail || done_.load(std::memory_order_acquire);
+      });
+    if(head_.load(std::memory_order_acquire) == tail)
+      return false;
+    const buffer& buf = buffers_[tail % nb_buffers];
+    begin             = buf.data;
+    end               = buf.data + buf.len;
+    last              = buf.last;
+    holding_          = true;
+    return true;
+  }
+
+  // Input position of the buffer held by the consumer
+  uint64_t input_pos() const {
+    return buffers_[tail_.load(std::memory_order_relaxed) % nb_buffers].input_pos;
+  }
+
+  // Tell the producer to give up
+  void stop() { stop_.store(true, std::memory_order_relaxed); }
+};
+
+// Reads the byte range [offset, end) of a file with its own I/O
+// thread into a chunk_ring, so the consumer only waits when it has
+// caught up with the disk.
+class readahead_source : public chunk_source {
+  const std::string      path_;
+  const int              fd_;
+  off_t                  offset_;
+  const off_t            end_;
+  chunk_ring             ring_;
+  std::thread            io_;
+  std::atomic<uint64_t>* progress_;
+  uint64_t               reported_; // Input position counted in progress_
+  uint64_t               held_;     // Input position at the end of the chunk being read
+
+  readahead_source(const readahead_source&);
+  readahead_source& operator=(const readahead_source&);
+
+  void fill() {
+    while(offset_ < end_) {
+      char* buf = ring_.acquire();
+      if(!buf)
+        break;
+      ssize_t len;
+      do {
+        len = pread(fd_, buf, std::min((off_t)ring_.buffer_size(), end_ - offset_), offset_);
+      } while(len == -1 && errno == EINTR);
+      if(len == -1)
+        jellyfish::err::die(jellyfish::err::msg() << "Failed to read input file '" << path_ << "'" << jellyfish::err::no);
+      if(len == 0)
+        break;
+      offset_ += len;
+      ring_.publish(len, false, offset_);
+    }
+    ring_.close();
+  }
+
+public:
+  readahead_source(const std::string& path, off_t offset, off_t end, size_t buffer_size,
+                   std::atomic<uint64_t>* progress = 0) :
+    path_(path), fd_(open(path.c_str(), O_RDONLY)), offset_(offset), end_(end), ring_(buffer_size),
+    progress_(progress), reported_(offset), held_(offset)
+  {
+    if(fd_ == -1)
+      jellyfish::err::die(jellyfish::err::msg() << "Failed to open input file '" << path << "'" << jellyfish::err::no);
+    posix_fadvise(fd_, offset, end - offset, POSIX_FADV_SEQUENTIAL);
+    io_ = std::thread(&readahead_source::fill, this);
+  }
+
+  virtual ~readahead_source() {
+    add_progress(progress_, held_ - reported_);
+    ring_.stop();
+    io_.join();
+    close(fd_);
+  }
+
+  virtual bool next(const char*& begin, const char*& end) {
+    add_progress(progress_, held_ - reported_);
+    reported_ = held_;
+    bool last;
+    if(!ring_.next(begin, end, last))
+      return false;
+    held_ = ring_.input_pos();
+    return true;
+  }
+};
+
+// Reads a file descriptor that can't seek or be mapped (stdin, a
+// pipe) front to back with its own I/O thread into a chunk_ring. Every
+// buffer is filled completely before it is handed out, so a pipe
+// delivering a few pages per read still gives large chunks.
+class pipe_source : public chunk_source {
+  const std::string      name_;
+  const int              fd_;
+  chunk_ring             ring_;
+  std::thread            io_;
+  std::atomic<uint64_t>* progress_;
+  size_t                 pending_; // Size of the chunk being read
+
+  pipe_source(const pipe_source&);
+  pipe_source& operator=(const pipe_source&);
+
+  void fill() {
+    for(bool eof = false; !eof; ) {
+      char* buf = ring_.acquire();
+      if(!buf)
+        break;
+      size_t len = 0;
+      while(len < ring_.buffer_size()) {
+        const ssize_t res = read(fd_, buf + len, ring_.buffer_size() - len);
+        if(res == -1 && errno == EINTR)
+          continue;
+        if(res == -1)
+          jellyfish::err::die(jellyfish::err::msg() << "Failed to read input '" << name_ << "'" << jellyfish::err::no);
+        if(res == 0) {
+          eof = true;
+          break;
+        }
+        len += res;
+      }
+      if(len)
+        ring_.publish(len);
+    }
+    ring_.close();
+  }
+
+public:
+  // Takes ownership of fd
+  pipe_source(const std::string& name, int fd, size_t buffer_size, std::atomic<uint64_t>* progress = 0) :
+    name_(name), fd_(fd), ring_(buffer_size), progress_(progress), pending_(0)
+  {
+#ifdef F_SETPIPE_SZ
+    fcntl(fd_, F_SETPIPE_SZ, 1 << 20); // Fewer wake ups of the writer, if allowed
+#endif
+    io_ = std::thread(&pipe_source::fill, this);
+  }
+
+  virtual ~pipe_source() {
+    add_progress(progress_, pending_);
+    ring_.stop();
+    io_.join();
+    close(fd_);
+  }
+
+  virtual bool next(const char*& begin, const char*& end) {
+    add_progress(progress_, pending_);
+    pending_ = 0;
+    bool last;
+    if(!ring_.next(begin, end, last))
+      return false;
+    pending_ = end - begin;
+    return true;
+  }
+};
+
+// The bytes [begin, end) then the chunks of source, e.g. to put back
+// what was read ahead of the data of a stream. The bytes must stay
+// valid until the next call to next().
+class prefixed_source : public chunk_source {
+  std::unique_ptr<chunk_source> source_;
+  const char*                   begin_;
+  const char*                   end_;
+
+public:
+  // Takes ownership of source
+  prefixed_source(chunk_source* source, const char* begin, const char* end) :
+    source_(source), begin_(begin), end_(end)
+  { }
+
+  virtual bool next(const char*& begin, const char*& end) {
+    if(begin_ != end_) {
+      begin  = begin_;
+      end    = end_;
+      begin_ = end_;
+      return true;
+    }
+    return source_->next(begin, end);
+  }
+};
+
+// std::streambuf reading the chunks of a chunk_source, for the
+// stream based readers and headers. Takes ownership of the source.
+class chunk_streambuf : public std::streambuf {
+  std::unique_ptr<chunk_source> source_;
+  uint64_t                      chunk_pos_; // Input position of the current chunk
+
+protected:
+  virtual int_type underflow() {
+    const char *begin, *end;
+    chunk_pos_ += egptr() - eback();
+    do {
+      if(!source_->next(begin, end))
+        return traits_type::eof();
+    } while(begin == end);
+    setg((char*)begin, (char*)begin, (char*)end);
+    return traits_type::to_int_type(*gptr());
+  }
+
+public:
+  explicit chunk_streambuf(chunk_source* source) : source_(source), chunk_pos_(0) { }
+
+  // Bytes of the input consumed
+  uint64_t consumed() const { return chunk_pos_ + (gptr() - eback()); }
+
+  // The source, positioned after the bytes consumed from offset: the
+  // streambuf is no longer usable.
+  chunk_source* release(uint64_t offset) {
+    if(offset < chunk_pos_ || offset > chunk_pos_ + (egptr() - eback()))
+      return 0;
+    const char* start = eback() + (offset - chunk_pos_);
+    return new prefixed_source(source_.release(), start, egptr());
+  }
+};
+
+#endif /* __KMER_UTILS_CHUNK_SOURCE_HPP__ */
@@ -0,0 +1,144 @@
+/**
+ * @file   coverage_histogram.hpp
+ *
+ * @brief 2D histogram of (assembly count, read count) pairs
+ *
+ * Counts up to a cap in each dimension are kept in a dense row major
+ * matrix; the rare pairs beyond the cap go to a sparse overflow map.
+ *
+ */
+#ifndef __KMER_UTILS_COVERAGE_HISTOGRAM_HPP__
+#define __KMER_UTILS_COVERAGE_HISTOGRAM_HPP__
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <utility>
+
+class coverage_histogram {
+  typedef std::map<std::pair<uint64_t, uint64_t>, uint64_t> overflow_map;
+
+  const uint64_t max_x_;
+  const uint64_t max_y_;
+  const uint64_t row_len_;
+  uint64_t*      dense_;
+  overflow_map   overflow_;
+
+  coverage_histogram(const coverage_histogram&);
+  coverage_histogram& operator=(const coverage_histogram&);
+
+public:
+  struct shape {
+    uint64_t max_x, max_y;
+  };
+
+  // Dense storage for x in [0, max_x] and y in [0, max_y]. calloc
+  // leaves untouched pages unmapped, so a generous cap is cheap.
+  coverage_histogram(uint64_t max_x, uint64_t max_y) :
+    max_x_(max_x), max_y_(max_y), row_len_(max_y + 1),
+    dense_((uint64_t*)calloc((max_x + 1) * row_len_, sizeof(uint64_t)))
+  {
+    if(!dense_)
+      throw std::bad_alloc();
+  }
+
+  explicit coverage_histogram(const shape& s) : coverage_histogram(s.max_x, s.max_y) { }
+
+  ~coverage_histogram() { free(dense_); }
+
+  uint64_t max_x() const { return max_x_; }
+  uint64_t max_y() const { return max_y_; }
+
+  // Dense matrix, (max_x + 1) rows of max_y + 1 counts
+  const uint64_t* dense() const { return dense_; }
+
+  // Number of cells beyond the cap
+  size_t nb_overflow() const { return overflow_.size(); }
+
+  // Number of k-mers in cell (x, y)
+  uint64_t at(uint64_t x, uint64_t y) const {
+    if(x <= max_x_ && y <= max_y_)
+      return dense_[x * row_len_ + y];
+    const auto it = overflow_.find(std::make_pair(x, y));
+    return it == overflow_.end() ? 0 : it->second;
+  }
+
+  void add(uint64_t x, uint64_t y, uint64_t n = 1) {
+    if(x <= max_x_ && y <= max_y_)
+      dense_[x * row_len_ + y] += n;
+    else
+      overflow_[std::make_pair(x, y)] += n;
+  }
+
+  // Add the first two counts of a merged k-mer
+  void add(const uint64_t* counts) { add(counts[0], counts[1]); }
+
+  coverage_histogram& operator+=(const coverage_histogram& rhs) {
+    if(rhs.max_x_ == max_x_ && rhs.max_y_ == max_y_) {
+      const uint64_t nb_cells = (max_x_ + 1) * row_len_;
+      for(uint64_t i = 0; i < nb_cells; ++i)
+        dense_[i] += rhs.dense_[i];
+    } else {
+      rhs.for_each_dense([this](uint64_t x, uint64_t y, uint64_t n) { add(x, y, n); });
+    }
+    for(const auto& c : rhs.overflow_)
+      add(c.first.first, c.first.second, c.second);
+    return *this;
+  }
+
+  // Multiply every cell by factor, rounding to the nearest integer
+  void scale(double factor) {
+    const uint64_t nb_cells = (max_x_ + 1) * row_len_;
+    for(uint64_t i = 0; i < nb_cells; ++i)
+      if(dense_[i])
+        dense_[i] = llround(dense_[i] * factor);
+    for(auto& c : overflow_)
+      c.second = llround(c.second * factor);
+  }
+
+  // Call f(x, y, n) for every non empty dense cell, in (x, y) order
+  template<typename F>
+  void for_each_dense(F f) const {
+    for(uint64_t x = 0; x <= max_x_; ++x) {
+      const uint64_t* row = dense_ + x * row_len_;
+      for(uint64_t y = 0; y <= max_y_; ++y)
+        if(row[y])
+          f(x, y, row[y]);
+    }
+  }
+
+  // Call f(x, y, n) for every cell beyond the cap, in (x, y) order
+  template<typename F>
+  void for_each_overflow(F f) const {
+    for(const auto& c : overflow_)
+      f(c.first.first, c.first.second, c.second);
+  }
+
+  // Call f(x, y, n) for every non empty cell, dense cells first
+  template<typename F>
+  void for_each(F f) const {
+    for_each_dense(f);
+    for_each_overflow(f);
+  }
+
+  // Call f(x, y, n) for every non empty cell in (x, y) order. Overflow
+  // cells of a dense row have y > max_y, so they follow the row.
+  template<typename F>
+  void for_each_sorted(F f) const {
+    auto it = overflow_.cbegin();
+    for(uint64_t x = 0; x <= max_x_; ++x) {
+      const uint64_t* row = dense_ + x * row_len_;
+      for(uint64_t y = 0; y <= max_y_; ++y)
+        if(row[y])
+          f(x, y, row[y]);
+      for( ; it != overflow_.cend() && it->first.first == x; ++it)
+        f(x, it->first.second, it->second);
+    }
+    for( ; it != overflow_.cend(); ++it)
+      f(it->first.first, it->first.second, it->second);
+  }
+};
+
+#endif /* __KMER_UTILS_COVERAGE_HISTOGRAM_HPP__ */
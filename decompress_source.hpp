@@ -0,0 +1,322 @@
+/**
+ * @file   decompress_source.hpp
+ *
+ * @brief Transparent decompression of gzip and zstd input databases
+ *
+ * A compressed database is split into independently decodable
+ * segments (the members of a BGZF file, the frames of a multi frame
+ * zstd file) that a pool of threads decompresses in parallel. Every
+ * thread streams its segments into its own chunk_ring, and the
+ * consumer reads the rings round robin, so the chunks come out in file
+ * order and memory stays bounded whatever the size of a segment. A
+ * file that can't be split (plain gzip, single frame zstd) is still
+ * decompressed by a thread of its own, ahead of the merge.
+ *
+ */
+#ifndef __KMER_UTILS_DECOMPRESS_SOURCE_HPP__
+#define __KMER_UTILS_DECOMPRESS_SOURCE_HPP__
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <jellyfish/err.hpp>
+
+#include "chunk_source.hpp"
+
+enum compression_type { no_compression, gzip_compression, zstd_compression };
+
+inline compression_type detect_compression(const char* data, size_t size) {
+  const unsigned char* d = (const unsigned char*)data;
+  if(size >= 2 && d[0] == 0x1f && d[1] == 0x8b)
+    return gzip_compression;
+  if(size >= 4 && d[0] == 0x28 && d[1] == 0xb5 && d[2] == 0x2f && d[3] == 0xfd)
+    return zstd_compression;
+  return no_compression;
+}
+
+// Streaming decoder of one segment of compressed data
+class block_decoder {
+public:
+  virtual ~block_decoder() { }
+
+  // Start decoding the compressed bytes [begin, end)
+  virtual void reset(const char* begin, const char* end) = 0;
+
+  // Decode up to len bytes into out. Returns the number of bytes
+  // written, less than len only at the end of the segment.
+  virtual size_t decode(char* out, size_t len) = 0;
+
+  // Compressed bytes of the segment consumed so far
+  virtual size_t consumed() const = 0;
+};
+
+// gzip, possibly made of several members
+class gzip_decoder : public block_decoder {
+  z_stream    z_;
+  const char* begin_;
+  const char* end_;
+  bool        in_member_; // Stopped in the middle of a member
+
+  gzip_decoder(const gzip_decoder&);
+  gzip_decoder& operator=(const gzip_decoder&);
+
+  // zlib counts input in 32 bit integers: feed it at most 1GiB at a time
+  void refill() {
+    if(z_.avail_in == 0 && (const char*)z_.next_in < end_)
+      z_.avail_in = std::min((size_t)(end_ - (const char*)z_.next_in), (size_t)1 << 30);
+  }
+
+public:
+  gzip_decoder() : begin_(0), end_(0), in_member_(false) {
+    memset(&z_, 0, sizeof(z_));
+    if(inflateInit2(&z_, 15 + 16) != Z_OK)
+      jellyfish::err::die("Failed to initialize gzip decoder");
+  }
+
+  virtual ~gzip_decoder() { inflateEnd(&z_); }
+
+  virtual void reset(const char* begin, const char* end) {
+    inflateReset(&z_);
+    z_.next_in  = (Bytef*)begin;
+    z_.avail_in = 0;
+    begin_      = begin;
+    end_        = end;
+    in_member_  = false;
+  }
+
+  virtual size_t decode(char* out, size_t len) {
+    z_.next_out  = (Bytef*)out;
+    z_.avail_out = len;
+    while(z_.avail_out > 0) {
+      refill();
+      if(z_.avail_in == 0) {
+        if(in_member_)
+          jellyfish::err::die("Truncated gzip input");
+        break;
+      }
+      const int ret = inflate(&z_, Z_NO_FLUSH);
+      in_member_    = ret != Z_STREAM_END;
+      if(ret == Z_STREAM_END) {
+        // Next member, if any
+        inflateReset(&z_);
+        continue;
+      }
+      if(ret == Z_BUF_ERROR && z_.avail_in == 0)
+        continue;
+      if(ret != Z_OK)
+        jellyfish::err::die(jellyfish::err::msg() << "Corrupted gzip input: " << (z_.msg ? z_.msg : "inflate failed"));
+    }
+    return len - z_.avail_out;
+  }
+
+  virtual size_t consumed() const { return (const char*)z_.next_in - begin_; }
+
+  // Members of a BGZF file, or the whole file if it isn't one. A BGZF
+  // member stores its length in a "BC" extra subfield of its header.
+  static void segments(const char* begin, const char* end, std::vector<const char*>& starts) {
+    const unsigned char* ptr = (const unsigned char*)begin;
+    const unsigned char* e   = (const unsigned char*)end;
+    starts.assign(1, begin);
+    while(ptr < e) {
+      if(e - ptr < 18 || ptr[0] != 0x1f || ptr[1] != 0x8b || !(ptr[3] & 4)) {
+        starts.assign(1, begin);
+        break;
+      }
+      const size_t         xlen  = ptr[10] | (ptr[11] << 8);
+      if(12 + xlen > (size_t)(e - ptr)) {
+        starts.assign(1, begin);
+        break;
+      }
+      const unsigned char* extra = ptr + 12;
+      size_t               bsize = 0;
+      for(size_t i = 0; i + 4 <= xlen; i += 4 + (extra[i + 2] | (extra[i + 3] << 8))) {
+        if(extra[i] == 'B' && extra[i + 1] == 'C' && (extra[i + 2] | (extra[i + 3] << 8)) == 2) {
+          bsize = (extra[i + 4] | (extra[i + 5] << 8)) + 1;
+          break;
+        }
+      }
+      if(!bsize || bsize > (size_t)(e - ptr)) {
+        starts.assign(1, begin);
+        break;
+      }
+      ptr += bsize;
+      if(ptr < e)
+        starts.push_back((const char*)ptr);
+    }
+    starts.push_back(end);
+  }
+};
+
+#ifdef HAVE_ZSTD
+// zstd, possibly made of several frames
+class zstd_decoder : public block_decoder {
+  ZSTD_DCtx*     ctx_;
+  ZSTD_inBuffer  in_;
+  size_t         hint_; // 0 when the last frame is complete
+
+  zstd_decoder(const zstd_decoder&);
+  zstd_decoder& operator=(const zstd_decoder&);
+
+public:
+  zstd_decoder() : ctx_(ZSTD_createDCtx()), hint_(0) {
+    if(!ctx_)
+      jellyfish::err::die("Failed to initialize zstd decoder");
+  }
+
+  virtual ~zstd_decoder() { ZSTD_freeDCtx(ctx_); }
+
+  virtual void reset(const char* begin, const char* end) {
+    ZSTD_DCtx_reset(ctx_, ZSTD_reset_session_only);
+    in_.src  = begin;
+    in_.size = end - begin;
+    in_.pos  = 0;
+    hint_    = 0;
+  }
+
+  virtual size_t decode(char* out, size_t len) {
+    ZSTD_outBuffer buf = { out, len, 0 };
+    while(buf.pos < buf.size) {
+      const size_t out_pos = buf.pos, in_pos = in_.pos;
+      const size_t ret     = ZSTD_decompressStream(ctx_, &buf, &in_);
+      if(ZSTD_isError(ret))
+        jellyfish::err::die(jellyfish::err::msg() << "Corrupted zstd input: " << ZSTD_getErrorName(ret));
+      if(buf.pos == out_pos && in_.pos == in_pos) {
+        if(hint_)
+          jellyfish::err::die("Truncated zstd input");
+        break;
+      }
+      hint_ = ret;
+    }
+    return buf.pos;
+  }
+
+  virtual size_t consumed() const { return in_.pos; }
+
+  // Frames of the file, each decodable on its own
+  static void segments(const char* begin, const char* end, std::vector<const char*>& starts) {
+    starts.clear();
+    for(const char* ptr = begin; ptr < end; ) {
+      starts.push_back(ptr);
+      const size_t len = ZSTD_findFrameCompressedSize(ptr, end - ptr);
+      if(ZSTD_isError(len))
+        jellyfish::err::die(jellyfish::err::msg() << "Corrupted zstd input: " << ZSTD_getErrorName(len));
+      ptr += len;
+    }
+    starts.push_back(end);
+  }
+};
+#endif
+
+// Decompressed content of the compressed bytes [begin, end), minus
+// its first skip bytes, decoded by up to nb_threads threads.
+class decompress_source : public chunk_source {
+  std::vector<const char*>                 starts_;   // Segment s is [starts_[s], starts_[s + 1])
+  std::vector<std::unique_ptr<chunk_ring>> rings_;    // Segments of thread i are i, i + nb_threads, ...
+  std::vector<std::thread>                 threads_;
+  size_t                                   segment_;  // Segment being read by the consumer
+  size_t                                   skip_;
+  std::atomic<uint64_t>*                   progress_; // Counts compressed bytes
+  uint64_t                                 reported_; // Compressed bytes counted in progress_
+  uint64_t                                 held_;     // Compressed bytes up to the end of the chunk being read
+
+  decompress_source(const decompress_source&);
+  decompress_source& operator=(const decompress_source&);
+
+  size_t nb_segments() const { return starts_.size() - 1; }
+
+  static void unsupported() {
+    jellyfish::err::die("Input is compressed in a format this build does not support");
+  }
+
+  static block_decoder* make_decoder(compression_type type) {
+    switch(type) {
+    case gzip_compression: return new gzip_decoder;
+#ifdef HAVE_ZSTD
+    case zstd_compression: return new zstd_decoder;
+#endif
+    default: break;
+    }
+    unsupported();
+    return 0;
+  }
+
+  // Decode the segments of thread id into its ring. A segment may
+  // cover several buffers; its last one is marked as such, even if
+  // empty, for the consumer to move on to the next ring.
+  void decode(compression_type type, size_t id) {
+    std::unique_ptr<block_decoder> decoder(make_decoder(type));
+    chunk_ring&                    ring = *rings_[id];
+    for(size_t s = id; s < nb_segments(); s += rings_.size()) {
+      decoder->reset(starts_[s], starts_[s + 1]);
+      for(bool last = false; !last; ) {
+        char* buf = ring.acquire();
+        if(!buf)
+          return;
+        const size_t len = decoder->decode(buf, ring.buffer_size());
+        last             = len < ring.buffer_size();
+        ring.publish(len, last, starts_[s] - starts_[0] + decoder->consumed());
+      }
+    }
+    ring.close();
+  }
+
+public:
+  decompress_source(compression_type type, const char* begin, const char* end, size_t skip,
+                    int nb_threads, std::atomic<uint64_t>* progress = 0, size_t buffer_size = 1 << 20) :
+    segment_(0), skip_(skip), progress_(progress), reported_(0), held_(0)
+  {
+    switch(type) {
+    case gzip_compression: gzip_decoder::segments(begin, end, starts_); break;
+#ifdef HAVE_ZSTD
+    case zstd_compression: zstd_decoder::segments(begin, end, starts_); break;
+#endif
+    default: unsupported();
+    }
+    const size_t nb = std::max((size_t)1, std::min((size_t)nb_threads, nb_segments()));
+    for(size_t i = 0; i < nb; ++i)
+      rings_.push_back(std::unique_ptr<chunk_ring>(new chunk_ring(buffer_size)));
+    for(size_t i = 0; i < nb; ++i)
+      threads_.push_back(std::thread(&decompress_source::decode, this, type, i));
+  }
+
+  virtual ~decompress_source() {
+    add_progress(progress_, held_ - reported_);
+    for(auto& ring : rings_)
+      ring->stop();
+    for(auto& th : threads_)
+      th.join();
+  }
+
+  virtual bool next(const char*& begin, const char*& end) {
+    add_progress(progress_, held_ - reported_);
+    reported_ = held_;
+    while(segment_ < nb_segments()) {
+      bool        last;
+      chunk_ring& ring = *rings_[segment_ % rings_.size()];
+      if(!ring.next(begin, end, last))
+        return false;
+      held_ = ring.input_pos();
+      if(last)
+        ++segment_;
+      if(skip_) {
+        const size_t len = std::min(skip_, (size_t)(end - begin));
+        begin += len;
+        skip_ -= len;
+      }
+      if(begin != end)
+        return true;
+    }
+    return false;
+  }
+};
+
+#endif /* __KMER_UTILS_DECOMPRESS_SOURCE_HPP__ */
@@ -0,0 +1,99 @@
+/**
+ * @file   fd_io.hpp
+ *
+ * @brief Small helpers for raw file descriptor output
+ *
+ */
+#ifndef __KMER_UTILS_FD_IO_HPP__
+#define __KMER_UTILS_FD_IO_HPP__
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <string>
+#include <vector>
+
+#include <jellyfish/err.hpp>
+
+// Write len bytes of buf to fd, retrying on short writes
+inline void write_fully(int fd, const char* buf, size_t len) {
+  while(len > 0) {
+    const ssize_t res = write(fd, buf, len);
+    if(res == -1) {
+      if(errno == EINTR)
+        continue;
+      jellyfish::err::die(jellyfish::err::msg() << "Failed to write output" << jellyfish::err::no);
+    }
+    buf += res;
+    len -= res;
+  }
+}
+
+// Flush the data written to fd to stable storage
+inline void sync_fully(int fd) {
+  if(fsync(fd) == -1)
+    jellyfish::err::die(jellyfish::err::msg() << "Failed to sync output" << jellyfish::err::no);
+}
+
+// Flush the entries of the directory of path to stable storage, e.g.
+// after renaming a file to path. File systems that can't sync a
+// directory (EINVAL) are left alone.
+inline void sync_directory(const std::string& path) {
+  const size_t      slash = path.rfind('/');
+  const std::string dir   = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+  const int         fd    = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if(fd == -1)
+    jellyfish::err::die(jellyfish::err::msg() << "Failed to open directory '" << dir << "'" << jellyfish::err::no);
+  if(fsync(fd) == -1 && errno != EINVAL)
+    jellyfish::err::die(jellyfish::err::msg() << "Failed to sync directory '" << dir << "'" << jellyfish::err::no);
+  close(fd);
+}
+
+// Open path for writing, truncating it, or die
+inline int open_output(const std::string& path, int flags = O_WRONLY | O_CREAT | O_TRUNC) {
+  const int fd = open(path.c_str(), flags, 0666);
+  if(fd == -1)
+    jellyfish::err::die(jellyfish::err::msg() << "Failed to open output file '" << path << "'" << jellyfish::err::no);
+  return fd;
+}
+
+// Copy len bytes from the start of in to offset out_off of out. Uses
+// copy_file_range so the kernel (or the file system, by sharing
+// extents) does the copy, with a pread/pwrite fallback. Positional
+// I/O only, so several threads may fill the same out.
+inline void copy_to_offset(int in, int out, off_t out_off, size_t len) {
+  loff_t in_off = 0, o_off = out_off;
+  while(len > 0) {
+    const ssize_t res = copy_file_range(in, &in_off, out, &o_off, len, 0);
+    if(res > 0) {
+      len -= res;
+      continue;
+    }
+    if(res == 0 || (errno != EINTR && errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP))
+      jellyfish::err::die(jellyfish::err::msg() << "Failed to copy output" << jellyfish::err::no);
+    if(errno == EINTR)
+      continue;
+
+    std::vector<char> buffer(1 << 20);
+    while(len > 0) {
+      const ssize_t rlen = pread(in, buffer.data(), std::min(len, buffer.size()), in_off);
+      if(rlen <= 0)
+        jellyfish::err::die(jellyfish::err::msg() << "Failed to read output segment" << jellyfish::err::no);
+      for(ssize_t done = 0; done < rlen; ) {
+        const ssize_t wlen = pwrite(out, buffer.data() + done, rlen - done, o_off);
+        if(wlen == -1 && errno == EINTR)
+          continue;
+        if(wlen <= 0)
+          jellyfish::err::die(jellyfish::err::msg() << "Failed to write output" << jellyfish::err::no);
+        done  += wlen;
+        o_off += wlen;
+      }
+      in_off += rlen;
+      len    -= rlen;
+    }
+  }
+}
+
+#endif /* __KMER_UTILS_FD_IO_HPP__ */
@@ -0,0 +1,140 @@
+/**
+ * @file   joint_histogram.hpp
+ *
+ * @brief Sparse N dimensional histogram of count tuples
+ *
+ * Number of k-mers for every tuple (count in input 0, ..., count in
+ * input N-1) seen in a merge. Tuples are stored inline in an open
+ * addressing table, so adding a tuple does not allocate.
+ *
+ */
+#ifndef __KMER_UTILS_JOINT_HISTOGRAM_HPP__
+#define __KMER_UTILS_JOINT_HISTOGRAM_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "coverage_histogram.hpp"
+
+class joint_histogram {
+  const unsigned        dims_;
+  const unsigned        width_; // dims_ counts followed by the number of k-mers
+  size_t                capacity_;
+  size_t                size_;
+  std::vector<uint64_t> table_;
+
+  joint_histogram(const joint_histogram&);
+  joint_histogram& operator=(const joint_histogram&);
+
+  size_t slot(const uint64_t* counts) const {
+    uint64_t h = 0;
+    for(unsigned i = 0; i < dims_; ++i)
+      h = (h ^ counts[i]) * 0x9e3779b97f4a7c15ULL;
+    return (h ^ (h >> 32)) & (capacity_ - 1);
+  }
+
+  // Cell holding counts, or the empty cell where it belongs
+  uint64_t* find(const uint64_t* counts) {
+    for(size_t i = slot(counts); ; i = (i + 1) & (capacity_ - 1)) {
+      uint64_t* cell = &table_[i * width_];
+      if(!cell[dims_] || !memcmp(cell, counts, sizeof(uint64_t) * dims_))
+        return cell;
+    }
+  }
+
+  void grow() {
+    std::vector<uint64_t> old(capacity_ * 2 * width_, 0);
+    old.swap(table_);
+    capacity_ *= 2;
+    size_      = 0;
+    for(size_t i = 0; i < old.size(); i += width_)
+      if(old[i + dims_])
+        add(&old[i], old[i + dims_]);
+  }
+
+public:
+  struct shape {
+    unsigned dims;
+  };
+
+  explicit joint_histogram(const shape& s) :
+    dims_(s.dims), width_(s.dims + 1), capacity_(1024), size_(0), table_(capacity_ * width_, 0)
+  { }
+
+  unsigned dims() const { return dims_; }
+  size_t size() const { return size_; }
+
+  // Number of k-mers with these counts
+  uint64_t at(const uint64_t* counts) const {
+    for(size_t i = slot(counts); ; i = (i + 1) & (capacity_ - 1)) {
+      const uint64_t* cell = &table_[i * width_];
+      if(!cell[dims_] || !memcmp(cell, counts, sizeof(uint64_t) * dims_))
+        return cell[dims_];
+    }
+  }
+
+  void add(const uint64_t* counts, uint64_t n = 1) {
+    uint64_t* cell = find(counts);
+    if(!cell[dims_]) {
+      if(2 * (size_ + 1) > capacity_) {
+        grow();
+        cell = find(counts);
+      }
+      memcpy(cell, counts, sizeof(uint64_t) * dims_);
+      ++size_;
+    }
+    cell[dims_] += n;
+  }
+
+  joint_histogram& operator+=(const joint_histogram& rhs) {
+    rhs.for_each([this](const uint64_t* counts, uint64_t n) { add(counts, n); });
+    return *this;
+  }
+
+  // Multiply every cell by factor, rounding to the nearest integer
+  void scale(double factor) {
+    for(size_t i = dims_; i < table_.size(); i += width_)
+      if(table_[i])
+        table_[i] = llround(table_[i] * factor);
+  }
+
+  // Call f(counts, n) for every tuple seen
+  template<typename F>
+  void for_each(F f) const {
+    for(size_t i = 0; i < table_.size(); i += width_)
+      if(table_[i + dims_])
+        f(&table_[i], table_[i + dims_]);
+  }
+
+  // Call f(counts, n) for every tuple seen, in lexicographic order of
+  // the counts
+  template<typename F>
+  void for_each_sorted(F f) const {
+    std::vector<const uint64_t*> cells;
+    cells.reserve(size_);
+    for(size_t i = 0; i < table_.size(); i += width_)
+      if(table_[i + dims_])
+        cells.push_back(&table_[i]);
+    const unsigned dims = dims_;
+    std::sort(cells.begin(), cells.end(), [dims](const uint64_t* a, const uint64_t* b) {
+        return std::lexicographical_compare(a, a + dims, b, b + dims);
+      });
+    for(const uint64_t* cell : cells)
+      f(cell, cell[dims_]);
+  }
+
+  // Add the 2D marginal of dimensions x and y to hist. Tuples absent
+  // from both dimensions are skipped, so the result is the histogram a
+  // merge of just those two inputs would give.
+  void marginal(unsigned x, unsigned y, coverage_histogram& hist) const {
+    for_each([&](const uint64_t* counts, uint64_t n) {
+        if(counts[x] || counts[y])
+          hist.add(counts[x], counts[y], n);
+      });
+  }
+};
+
+#endif /* __KMER_UTILS_JOINT_HISTOGRAM_HPP__ */
@@ -3,7 +3,7 @@
  * @author Per Unneberg
  * @date   Thu Feb 18 19:54:02 2021
  *
- * @brief Count kmer occurrences from two jellyfish databases
+ * @brief Count kmer occurrences from two or more jellyfish databases
  *
  * Based on
  * https://github.com/gmarcais/Jellyfish/tree/master/examples/count_in_file
@@ -13,166 +13,349 @@
  */
 
 #include <getopt.h>
+#include <sys/stat.h>
+#include <cstring>
 #include <iostream>
-#include <fstream>
-#include <vector>
-#include <memory>
 #include <string>
-#include <unordered_map>
-
-#include <jellyfish/err.hpp>
-#include <jellyfish/misc.hpp>
-#include <jellyfish/mer_heap.hpp>
-#include <jellyfish/jellyfish.hpp>
-#include <jellyfish/rectangular_binary_matrix.hpp>
-#include <jellyfish/cpp_array.hpp>
-
-namespace err = jellyfish::err;
-
-using jellyfish::file_header;
-using jellyfish::RectangularBinaryMatrix;
-using jellyfish::mer_dna;
-using jellyfish::cpp_array;
-typedef std::unique_ptr<binary_reader>           binary_reader_ptr;
-typedef std::unique_ptr<text_reader>             text_reader_ptr;
-typedef jellyfish::cooperative::hash_counter<jellyfish::mer_dna>                  mer_hash_t;
-
-struct file_info {std::ifstream is;
-  file_header   header;
-
-  file_info(const char* path) :
-    is(path),
-    header(is)
-  { }
-};
-
-
-struct common_info {
-  unsigned int            key_len;
-  size_t                  max_reprobe_offset;
-  size_t                  size;
-  unsigned int            out_counter_len;
-  std::string             format;
-  RectangularBinaryMatrix matrix;
-
-  common_info(RectangularBinaryMatrix&& m) : matrix(std::move(m))
-  { }
-};
-
-common_info read_headers(int argc, char* input_files[], cpp_array<file_info>& files) {
-  // Read first file
-  files.init(0, input_files[0]);
-  if(!files[0].is.good())
-    err::die(err::msg() << "Failed to open input file '" << input_files[0] << "'");
-
-  file_header& h = files[0].header;
-  common_info res(h.matrix());
-  res.key_len            = h.key_len();
-  res.max_reprobe_offset = h.max_reprobe_offset();
-  res.size               = h.size();
-  res.format = h.format();
-  size_t reprobes[h.max_reprobe() + 1];
-  h.get_reprobes(reprobes);
-  res.out_counter_len = h.counter_len();
-
-  // Other files must match
-  for(int i = 1; i < argc; i++) {
-    files.init(i, input_files[i]);
-    file_header& nh = files[i].header;
-    if(!files[i].is.good())
-      err::die(err::msg() << "Failed to open input file '" << input_files[i] << "'");
-    if(res.format != nh.format())
-      err::die(err::msg() << "Can't compare files with different formats (" << res.format << ", " << nh.format() << ")");
-    if(res.key_len != nh.key_len())
-      err::die(err::msg() << "Can't compare hashes of different key lengths (" << res.key_len << ", " << nh.key_len() << ")");
-    if(res.max_reprobe_offset != nh.max_reprobe_offset())
-      err::die("Can't compare hashes with different reprobing strategies");
-    if(res.size != nh.size())
-      err::die(err::msg() << "Can't compare hash with different size (" << res.size << ", " << nh.size() << ")");
-    if(res.matrix != nh.matrix())
-      err::die("Can't compare hash with different hash function");
+#include <vector>
+
+#include "kmer_count_pairs.hpp"
+#include "kmer_query.hpp"
+
+static coverage_histogram::shape parse_cap(const char* arg) {
+  coverage_histogram::shape cap;
+  char* comma;
+  cap.max_x = strtoull(arg, &comma, 10);
+  if(*comma != ',')
+    err::die(err::msg() << "Invalid dense histogram cap '" << arg << "', expected A,R");
+  cap.max_y = strtoull(comma + 1, 0, 10);
+  return cap;
+}
+
+// An input argument: a database, or a group of databases, e.g. the
+// intermediate files of a jellyfish count, written [name=]db,db,...
+// whose counts are summed. Returns the paths of the databases.
+static std::vector<std::string> parse_input(const char* arg, std::string& name) {
+  std::vector<std::string> paths;
+  struct stat              st;
+  if(stat(arg, &st) == 0 || (!strchr(arg, ',') && !strchr(arg, '='))) {
+    paths.push_back(arg);
+    return paths;
+  }
+  const char* eq = strchr(arg, '=');
+  if(eq)
+    name.assign(arg, eq);
+  for(const char* p = eq ? eq + 1 : arg; ; ) {
+    const char* comma = strchr(p, ',');
+    paths.push_back(std::string(p, comma ? comma : p + strlen(p)));
+    if(paths.back().empty())
+      err::die(err::msg() << "Invalid input group '" << arg << "', expected [name=]db,db,...");
+    if(!comma)
+      break;
+    p = comma + 1;
   }
+  return paths;
+}
 
-  return res;
+// Expand the input arguments into the databases of their groups, the
+// name of their group and the input they are part of
+static void expand_inputs(int nb_inputs, char* args[], std::vector<std::string>& paths,
+                          std::vector<std::string>& names, std::vector<unsigned>& input_of) {
+  for(int i = 0; i < nb_inputs; ++i) {
+    std::string                    name;
+    const std::vector<std::string> group = parse_input(args[i], name);
+    for(const auto& path : group) {
+      paths.push_back(path);
+      names.push_back(name);
+      input_of.push_back(i);
+    }
+  }
 }
 
-template<typename reader_type>
-void output_counts(cpp_array<file_info>& files, mer_hash_t& mer_hash_, char *outfile) {
-  cpp_array<reader_type> readers(files.size());
-  typedef jellyfish::mer_heap::heap<mer_dna, reader_type> heap_type;
-  typedef typename heap_type::const_item_t heap_item;
-  heap_type heap(files.size());
-  std::ofstream outfile_;
-
-  // Prime heap
-  for(size_t i = 0; i < files.size(); ++i) {
-    readers.init(i, files[i].is, &files[i].header);
-    if(readers[i].next())
-      heap.push(readers[i]);
+// Count bounds of --min/--max, C,C,... for the inputs in order. An
+// empty field leaves an input unbounded (def).
+static void parse_bounds(const char* arg, unsigned nb_inputs, uint64_t def, std::vector<uint64_t>& bounds) {
+  const char* p = arg;
+  for(unsigned i = 0; *p; ++i) {
+    if(i >= nb_inputs)
+      err::die(err::msg() << "Too many count bounds '" << arg << "' for " << nb_inputs << " inputs");
+    char* end;
+    bounds[i] = *p == ',' ? def : strtoull(p, &end, 10);
+    if(*p != ',') {
+      if(end == p || (*end && *end != ','))
+        err::die(err::msg() << "Invalid count bounds '" << arg << "', expected C,C,...");
+      p = end;
+    }
+    if(*p == ',')
+      ++p;
   }
+}
+
+// kmer_count_pairs hist-merge: sum the .khist files of partial merges
+static int hist_merge_main(int argc, char *argv[])
+{
+  const char* usage =
+    "kmer_count_pairs hist-merge [options] partial.khist... out_prefix\n"
+    "\nSum the partial histograms written by kmer_count_pairs -H, each of a\n"
+    "merge of a disjoint part of the k-mers, and write the histogram(s) of\n"
+    "the whole merge as kmer_count_pairs would.\n\n"
+    "Options:\n"
+    "\t-c/--dense-cap\tA,R largest assembly and read counts kept in the dense histogram (1023,10000)\n"
+    "\t-s/--sorted\tSort rows by assembly count, then read count(s)\n"
+    "\t-n/--npy\tAlso write each histogram as numpy arrays\n"
+    "\t-H/--partial\tAlso write the sum as out_prefix.khist\n"
+    "\t-S/--stats\tWrite timings of the run to this JSON file\n"
+    "\t-h/--help\tPrint help message \n\n";
+
+  int c;
+  std::string stats_path;
+  output_config out = { "", { 1023, 10000 }, false, false, false };
+  while (1) {
+    int option_index = 0;
+    static struct option long_options[] = {
+      {"dense-cap", required_argument, 0,  'c' },
+      {"sorted",    no_argument,       0,  's' },
+      {"npy",       no_argument,       0,  'n' },
+      {"partial",   no_argument,       0,  'H' },
+      {"stats",     required_argument, 0,  'S' },
+      {"help",  no_argument,       0,  'h' },
+      {0,         0,                 0,  0 }
+    };
+    c = getopt_long(argc, argv, "c:snHS:h", long_options, &option_index);
+    if (c == -1)
+      break;
 
-  heap_item          head      = heap.head();
-  mer_dna            key;
-  const int          num_files = files.size();
-  const reader_type* base      = &readers[0];
-  uint64_t           counts[num_files];
-
-  std::unordered_map<uint64_t, std::unordered_map<uint64_t, uint64_t>> coverage_count;
-
-  while(heap.is_not_empty()) {
-    key = head->key_;
-    memset(counts, '\0', sizeof(uint64_t) * num_files);
-    // Heap consists of ordered array from both files; collect all
-    // keys of given type before moving on
-    do {
-      counts[head->it_ - base] = head->val_;
-      heap.pop();
-      if(head->it_->next())
-        heap.push(*head->it_);
-      head = heap.head();
-    } while(head->key_ == key && heap.is_not_empty());
-
-    // Assembly counts in slot 1, read counts in slot 2
-    coverage_count[counts[0]][counts[1]]++;
-    mer_hash_.add(key, counts[0]);
+    switch (c) {
+    case 'c':
+      out.cap = parse_cap(optarg);
+      break;
+    case 's':
+      out.sorted = true;
+      break;
+    case 'n':
+      out.npy = true;
+      break;
+    case 'H':
+      out.partial = true;
+      break;
+    case 'S':
+      stats_path = optarg;
+      break;
+    case 'h':
+      std::cerr << usage;
+      std::exit(0);
+    case '?':
+      break;
+    }
+  };
+
+  if ((argc - optind) < 2)
+    err::die(err::msg() << usage);
+
+  run_stats stats;
+  stats.threads = 1;
+  out.prefix = argv[argc - 1];
+  const std::vector<std::string> paths(argv + optind, argv + argc - 1);
+  merge_partials(paths, out, stats);
+  if(!stats_path.empty())
+    stats.write_json(stats_path);
+  return 0;
+}
+
+// kmer_count_pairs query: counts of a list of k-mers in every input
+static int query_main(int argc, char *argv[])
+{
+  const char* usage =
+    "kmer_count_pairs query [options] queries assembly_file read_file... out_prefix\n"
+    "\nWrite the count of every k-mer of queries in each database to\n"
+    "out_prefix.tsv, rows of the k-mer followed by its counts, in the order of\n"
+    "the queries. queries ('-' for stdin) is a list of k-mers, one per line, or\n"
+    "a FASTA file whose every k-mer is queried (but those with other bases than\n"
+    "ACGT). Databases may be groups, [name=]db,db,..., as for the merge.\n\n"
+    "The queries are sorted by hash position and answered in one pass over\n"
+    "each database, which skips to the next query with a binary search where\n"
+    "it is far ahead.\n\n"
+    "Options:\n"
+    "\t-t/--threads\tNumber of threads answering runs of the sorted queries (1)\n"
+    "\t-S/--stats\tWrite timings and counters of the run to this JSON file\n"
+    "\t-h/--help\tPrint help message \n\n";
+
+  int c;
+  int nb_threads = 1;
+  std::string stats_path;
+  while (1) {
+    int option_index = 0;
+    static struct option long_options[] = {
+      {"threads",   required_argument, 0,  't' },
+      {"stats",     required_argument, 0,  'S' },
+      {"help",  no_argument,       0,  'h' },
+      {0,         0,                 0,  0 }
+    };
+    c = getopt_long(argc, argv, "t:S:h", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 't':
+      nb_threads = atoi(optarg);
+      if(nb_threads < 1)
+        err::die(err::msg() << "Invalid number of threads '" << optarg << "'");
+      break;
+    case 'S':
+      stats_path = optarg;
+      break;
+    case 'h':
+      std::cerr << usage;
+      std::exit(0);
+    case '?':
+      break;
+    }
+  };
+
+  if ((argc - optind) < 3)
+    err::die(err::msg() << usage);
+
+  const char*              queries_path = argv[optind];
+  const int                nb_inputs    = argc - optind - 2;
+  std::vector<std::string> paths, names;
+  std::vector<unsigned>    input_of;
+  expand_inputs(nb_inputs, argv + optind + 1, paths, names, input_of);
+  std::vector<char*> path_args;
+  for(auto& path : paths)
+    path_args.push_back(&path[0]);
+
+  const int nb_files = paths.size();
+  cpp_array<file_info> files(nb_files);
+  run_stats stats;
+  common_info cinfo = [&]() {
+    phase_timer timer(stats, "read_headers");
+    return read_headers(nb_files, path_args.data(), files);
+  }();
+  cinfo.nb_inputs = nb_inputs;
+  for(int i = 0; i < nb_files; ++i) {
+    files[i].input      = input_of[i];
+    files[i].input_name = names[i];
+    // Compressed inputs and streams are read once, from the start
+    if(!files[i].seekable())
+      nb_threads = 1;
   }
+  mer_dna::k(cinfo.key_len / 2);
+  stats.threads = nb_threads;
+  stats.ranges  = nb_threads;
 
-  outfile_.open(outfile);
-  for (const std::pair<uint64_t, std::unordered_map<uint64_t, uint64_t>>& x : coverage_count) {
-    for (const std::pair<uint64_t, uint64_t>& y : x.second) {
-      outfile_ << x.first << "\t" << y.first << "\t" << y.second << std::endl;
+  query_list queries(cinfo.key_len / 2);
+  {
+    phase_timer timer(stats, "read_queries");
+    if(!strcmp(queries_path, "-")) {
+      queries.read(std::cin);
+    } else {
+      std::ifstream is(queries_path);
+      if(!is.good())
+        err::die(err::msg() << "Failed to open queries '" << queries_path << "'" << err::no);
+      queries.read(is);
     }
   }
+  query_counts(files, cinfo, queries, std::string(argv[argc - 1]) + ".tsv", nb_threads, stats);
+
+  if(!stats_path.empty())
+    stats.write_json(stats_path);
+  return 0;
 }
 
 int main(int argc, char *argv[])
 {
+  if(argc > 1 && std::string(argv[1]) == "hist-merge")
+    return hist_merge_main(argc - 1, argv + 1);
+  if(argc > 1 && std::string(argv[1]) == "query")
+    return query_main(argc - 1, argv + 1);
+
   const char* usage =
-    "kmer_count_pairs [options] assembly_file read_file out_prefix\n"
+    "kmer_count_pairs [options] assembly_file read_file... out_prefix\n"
+    "kmer_count_pairs hist-merge [options] partial.khist... out_prefix\n"
+    "kmer_count_pairs query [options] queries assembly_file read_file... out_prefix\n"
     "\nArguments:\n"
     "\tassembly_file\t\tjellyfish database from genome assembly\n"
-    "\tread_file\t\tjellyfish database from short read data\n"
+    "\tread_file\t\tjellyfish database(s) from short read data\n"
     "\tout_prefix\t\toutput prefix\n\n"
+    "A database may be given as a group of databases, [name=]db,db,... such as\n"
+    "the intermediate files of a jellyfish count, whose counts are summed on the\n"
+    "fly, without a jellyfish merge.\n\n"
+    "Databases may be gzip or zstd compressed. BGZF (bgzip) and multi frame\n"
+    "zstd (pzstd) files are decompressed by all threads. A database may also\n"
+    "be read once, front to back, from stdin ('-') or a named pipe, e.g. from\n"
+    "<(zstdcat db.jf.zst).\n\n"
+    "With more than one read_file, out_prefix.tsv holds the joint counts in\n"
+    "all databases and out_prefix_i_j.tsv the counts in databases i and j.\n\n"
     "Options:\n"
-    "\t-m/--savemergs\tSave mer-file\n"
+    "\t-m/--savemers\tSave mer-file\n"
+    "\t-t/--threads\tNumber of threads merging hash position ranges (1)\n"
+    "\t-c/--dense-cap\tA,R largest assembly and read counts kept in the dense histogram (1023,10000)\n"
+    "\t-s/--sorted\tSort rows by assembly count, then read count(s)\n"
+    "\t-n/--npy\tAlso write each histogram as numpy arrays: out.npy, the dense\n"
+    "\t\t\tmatrix up to the dense cap, and out_coo.npy, rows (counts..., k-mers) of\n"
+    "\t\t\tthe cells beyond it (all cells with more than one read_file)\n"
+    "\t-H/--partial\tAlso write the histogram as out_prefix.khist, for hist-merge\n"
+    "\t-x/--shard\tI/N merge only the I-th (from 0) of N slices of the hash positions,\n"
+    "\t\t\treading about 1/N of each uncompressed database. The -H outputs of the\n"
+    "\t\t\tN shards sum to the whole merge with hist-merge\n"
+    "\t-f/--fraction\tF preview: merge only the first F (0 < F <= 1) of the hash positions,\n"
+    "\t\t\ta random sample of the k-mers, and scale the histograms by 1/F. The\n"
+    "\t\t\tpositions are merged in strata (8 or --threads) and out_prefix_ci.tsv\n"
+    "\t\t\tholds rows (counts..., estimate, low, high) of the 95% confidence\n"
+    "\t\t\tinterval of each cell, from the variance between strata (not for streams)\n"
+    "\t-L/--min\tC,C,... keep only the k-mers with at least these counts in the\n"
+    "\t\t\tinputs, in order (empty field: no bound), e.g. ,3 for 3 or more reads\n"
+    "\t-U/--max\tC,C,... keep only the k-mers with at most these counts in the inputs.\n"
+    "\t\t\tThe other k-mers are left out of all histograms and the mer-file\n"
+    "\t-C/--checkpoint\tCheckpoint every range of the merge every this many seconds to\n"
+    "\t\t\tout_prefix.ckpt.<range>, removed once the outputs are written\n"
+    "\t-R/--resume\tResume from the checkpoints of an interrupted run with the same\n"
+    "\t\t\tinputs, out_prefix, --threads and --shard\n"
+    "\t-r/--readahead\tMiB read ahead per binary input and range by an I/O thread (0, read the mapping)\n"
+    "\t-S/--stats\tWrite timings and counters of the run to this JSON file\n"
+    "\t-p/--progress\tReport progress on stderr every this many seconds\n"
+    "\t-P/--progress-machine\tReport progress as PROGRESS lines of tab separated key=value (every 60s without -p)\n"
     "\t-h/--help\tPrint help message \n\n";
 
 
-  jellyfish::file_header header;
-  header.fill_standard();
-  header.set_cmdline(argc, argv);
-
   // Get options
   int c;
   bool saveMers = false;
+  int nb_threads = 1;
+  size_t readahead = 0;
+  std::string stats_path;
+  double progress_interval = 0;
+  bool progress_machine = false;
+  size_t shard_index = 0, shard_count = 1;
+  double fraction = 1;
+  bool preview = false;
+  checkpoint_config ckpt;
+  const char* min_counts = 0;
+  const char* max_counts = 0;
+  output_config out = { "", { 1023, 10000 }, false, false, false };
   while (1) {
     int option_index = 0;
     static struct option long_options[] = {
-      {"savemers",  no_argument,       0,  0 },
-      {"help",  no_argument,       0,  0 },
+      {"savemers",  no_argument,       0,  'm' },
+      {"threads",   required_argument, 0,  't' },
+      {"dense-cap", required_argument, 0,  'c' },
+      {"sorted",    no_argument,       0,  's' },
+      {"npy",       no_argument,       0,  'n' },
+      {"partial",   no_argument,       0,  'H' },
+      {"shard",     required_argument, 0,  'x' },
+      {"fraction",  required_argument, 0,  'f' },
+      {"min",       required_argument, 0,  'L' },
+      {"max",       required_argument, 0,  'U' },
+      {"checkpoint", required_argument, 0, 'C' },
+      {"resume",    no_argument,       0,  'R' },
+      {"readahead", required_argument, 0,  'r' },
+      {"stats",     required_argument, 0,  'S' },
+      {"progress",  required_argument, 0,  'p' },
+      {"progress-machine", no_argument, 0, 'P' },
+      {"help",  no_argument,       0,  'h' },
       {0,         0,                 0,  0 }
     };
-    c = getopt_long(argc, argv, "mh", long_options, &option_index);
+    c = getopt_long(argc, argv, "mt:c:snHx:f:L:U:C:Rr:S:p:Ph", long_options, &option_index);
     if (c == -1)
       break;
 
@@ -180,6 +363,65 @@ int main(int argc, char *argv[])
     case 'm':
       saveMers = true;
       break;
+    case 't':
+      nb_threads = atoi(optarg);
+      if(nb_threads < 1)
+        err::die(err::msg() << "Invalid number of threads '" << optarg << "'");
+      break;
+    case 'c':
+      out.cap = parse_cap(optarg);
+      break;
+    case 's':
+      out.sorted = true;
+      break;
+    case 'n':
+      out.npy = true;
+      break;
+    case 'H':
+      out.partial = true;
+      break;
+    case 'x': {
+      char* slash;
+      shard_index = strtoull(optarg, &slash, 10);
+      shard_count = *slash == '/' ? strtoull(slash + 1, 0, 10) : 0;
+      if(shard_count < 1 || shard_index >= shard_count)
+        err::die(err::msg() << "Invalid shard '" << optarg << "', expected I/N with 0 <= I < N");
+      break;
+    }
+    case 'f':
+      fraction = atof(optarg);
+      if(!(fraction > 0 && fraction <= 1))
+        err::die(err::msg() << "Invalid fraction '" << optarg << "', expected 0 < F <= 1");
+      preview = true;
+      break;
+    case 'L':
+      min_counts = optarg;
+      break;
+    case 'U':
+      max_counts = optarg;
+      break;
+    case 'C':
+      ckpt.interval = atof(optarg);
+      if(ckpt.interval <= 0)
+        err::die(err::msg() << "Invalid checkpoint interval '" << optarg << "'");
+      break;
+    case 'R':
+      ckpt.resume = true;
+      break;
+    case 'r':
+      readahead = strtoull(optarg, 0, 10) << 20;
+      break;
+    case 'S':
+      stats_path = optarg;
+      break;
+    case 'p':
+      progress_interval = atof(optarg);
+      if(progress_interval <= 0)
+        err::die(err::msg() << "Invalid progress interval '" << optarg << "'");
+      break;
+    case 'P':
+      progress_machine = true;
+      break;
     case 'h':
       std::cerr << usage;
       std::exit(0);
@@ -189,36 +431,97 @@ int main(int argc, char *argv[])
   };
 
   // Check number of arguments
-  if ((argc - optind) != 3)
+  if ((argc - optind) < 3)
     err::die(err::msg() << usage);
 
+  // Expand the groups into their files
+  const int                nb_inputs = argc - optind - 1;
+  std::vector<std::string> paths, names;
+  std::vector<unsigned>    input_of;
+  expand_inputs(nb_inputs, argv + optind, paths, names, input_of);
+  std::vector<char*> path_args;
+  for(auto& path : paths)
+    path_args.push_back(&path[0]);
+
   // Read the header of each input files and do sanity checks.
-  cpp_array<file_info> files(2);
-  common_info cinfo = read_headers(2, argv + optind, files);
+  const int nb_files = paths.size();
+  cpp_array<file_info> files(nb_files);
+  run_stats stats;
+  common_info cinfo = [&]() {
+    phase_timer timer(stats, "read_headers");
+    return read_headers(nb_files, path_args.data(), files);
+  }();
+  cinfo.nb_inputs = nb_inputs;
+  if(min_counts || max_counts) {
+    cinfo.filter.resize(nb_inputs);
+    if(min_counts)
+      parse_bounds(min_counts, nb_inputs, 0, cinfo.filter.min);
+    if(max_counts)
+      parse_bounds(max_counts, nb_inputs, std::numeric_limits<uint64_t>::max(), cinfo.filter.max);
+  }
+  for(int i = 0; i < nb_files; ++i) {
+    files[i].input      = input_of[i];
+    files[i].input_name = names[i];
+  }
   mer_dna::k(cinfo.key_len / 2);
+  if(shard_count > cinfo.size)
+    err::die(err::msg() << "Can't split " << cinfo.size << " hash positions in " << shard_count << " shards");
+  cinfo.shard(shard_index, shard_count);
+
+  // Compressed inputs and streams can't be split in ranges: merge in a
+  // single range and spend the threads on decompression instead.
+  int nb_ranges = nb_threads;
+  bool streamed = false;
+  for(int i = 0; i < nb_files; ++i) {
+    files[i].readahead          = readahead;
+    files[i].decompress_threads = nb_threads;
+    if(!files[i].seekable())
+      nb_ranges = 1;
+    streamed = streamed || files[i].stream;
+  }
+  // A stream is read once, front to back: a single stratum, no interval
+  if(preview)
+    cinfo.preview(fraction, streamed ? 1 : std::max(8, nb_threads));
+  stats.threads = nb_threads;
+  stats.ranges  = std::max(nb_ranges, (int)cinfo.strata);
+
+  if(progress_machine && !progress_interval)
+    progress_interval = 60;
+  std::unique_ptr<progress_reporter> progress;
+  if(progress_interval > 0) {
+    std::vector<progress_reporter::input> inputs;
+    for(int i = 0; i < nb_files; ++i) {
+      const std::string name = files[i].input_name.empty() ? files[i].path : files[i].input_name + ":" + files[i].path;
+      const progress_reporter::input input = { name, &files[i].bytes_done, &files[i].kmers_done,
+                                               &files[i].bytes_total };
+      inputs.push_back(input);
+    }
+    progress.reset(new progress_reporter(inputs, progress_interval, progress_machine));
+  }
+
+  // table output file prefix
+  out.prefix  = argv[argc - 1];
+  ckpt.prefix = out.prefix;
+  if(!saveMers) {
+    discard_mers mers;
+    output_counts(files, cinfo, mers, out, ckpt, nb_ranges, stats);
+    if(progress)
+      progress->stop();
+  } else {
+    // The mer-file keeps the hash function and order of the inputs
+    file_header mers_header(files[0].header);
+    mers_header.fill_standard();
+    mers_header.set_cmdline(argc, argv);
+    stream_mers mers(out.prefix + "_mers.jf", mers_header, stats.ranges, ckpt.resume);
+    output_counts(files, cinfo, mers, out, ckpt, nb_ranges, stats);
+    if(progress)
+      progress->stop();
+    phase_timer timer(stats, "mers_dump");
+    mers.finish();
+  }
+  ckpt.remove(stats.ranges);
 
-  std::unique_ptr<jellyfish::dumper_t<mer_array> > dumper;
-
-  char outfile[1024];
-  strcpy(outfile, argv[argc - 1]);
-  strcat(outfile, "_mers.jf");
-
-  mer_hash_t mer_hash(cinfo.size, cinfo.key_len, 24, 1, 126);
-  dumper.reset(new binary_dumper(4, mer_hash.key_len(), 1, outfile, &header));
-  dumper->one_file(true);
-  mer_hash.dumper(dumper.get());
-
-  // table output file name
-  char tablefile[1024];
-  strcpy(tablefile, argv[3]);
-  strcat(tablefile, ".tsv");
-  if(cinfo.format == binary_dumper::format)
-    output_counts<binary_reader>(files, mer_hash, tablefile);
-  else if (cinfo.format == text_dumper::format)
-    output_counts<text_reader>(files, mer_hash, tablefile);
-  else
-    err::die(err::msg() << "Format '" << cinfo.format << "' not supported\n");
-  if (saveMers)
-    dumper->dump(mer_hash.ary());
+  if(!stats_path.empty())
+    stats.write_json(stats_path);
   return 0;
 }
@@ -0,0 +1,1079 @@
+/**
+ * @file   kmer_count_pairs.hpp
+ *
+ * @brief Merge of jellyfish databases behind kmer_count_pairs
+ *
+ * Reading and checking the inputs, the range partitioned merge and
+ * the output of its histograms, shared by the program and the
+ * benchmarks.
+ *
+ */
+#ifndef __KMER_UTILS_KMER_COUNT_PAIRS_HPP__
+#define __KMER_UTILS_KMER_COUNT_PAIRS_HPP__
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <string>
+#include <limits>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+
+#include <jellyfish/err.hpp>
+#include <jellyfish/misc.hpp>
+#include <jellyfish/jellyfish.hpp>
+#include <jellyfish/rectangular_binary_matrix.hpp>
+#include <jellyfish/cpp_array.hpp>
+
+#include "mapped_file.hpp"
+#include "binary_chunk_reader.hpp"
+#include "text_chunk_reader.hpp"
+#include "static_mer.hpp"
+#include "decompress_source.hpp"
+#include "coverage_histogram.hpp"
+#include "joint_histogram.hpp"
+#include "loser_tree.hpp"
+#include "binary_mer_writer.hpp"
+#include "tsv_writer.hpp"
+#include "npy_writer.hpp"
+#include "partial_histogram.hpp"
+#include "checkpoint.hpp"
+#include "run_stats.hpp"
+#include "progress_reporter.hpp"
+
+namespace err = jellyfish::err;
+
+using jellyfish::file_header;
+using jellyfish::RectangularBinaryMatrix;
+using jellyfish::mer_dna;
+using jellyfish::cpp_array;
+typedef std::unique_ptr<binary_reader>           binary_reader_ptr;
+typedef std::unique_ptr<text_reader>             text_reader_ptr;
+
+// Destinations for the merged k-mers. The merge loop is instantiated
+// for each, and every merge thread feeds its own local sink.
+struct discard_mers {
+  struct local {
+    local(discard_mers&, int, uint64_t = 0) { }
+    template<typename mer_type>
+    void add(const mer_type&, uint64_t) { }
+    void done() { }
+    uint64_t checkpoint() { return 0; }
+  };
+};
+
+// Streams the merged k-mers into a binary/sorted jellyfish database.
+// The merge emits k-mers in hash position order, so records are
+// written as they come and no hash table is needed. Every merge
+// thread writes its own range: thread 0 after the header of the
+// output file, the other threads to segment files path.<id> that
+// finish() copies into place in parallel. A resumed merge keeps the
+// output of the interrupted run up to the checkpointed records.
+class stream_mers {
+  const std::string path_;
+  const unsigned    key_len_;
+  const int         nb_threads_;
+  bool              resume_;
+  size_t            header_len_;
+
+  std::string segment_path(int id) const { return path_ + "." + std::to_string(id); }
+
+  // Output of thread id, opened for appending after its first records
+  int open_segment(int id, uint64_t records) const {
+    if(!resume_)
+      return id ? open_output(segment_path(id)) : open_output(path_, O_WRONLY | O_APPEND);
+    const std::string path = id ? segment_path(id) : path_;
+    const int         fd   = open_output(path, O_WRONLY | O_CREAT | O_APPEND);
+    if(ftruncate(fd, (id ? 0 : header_len_) + records * ((key_len_ + 7) / 8 + val_len)) == -1)
+      err::die(err::msg() << "Failed to truncate output file '" << path << "'" << err::no);
+    return fd;
+  }
+
+public:
+  static const unsigned int val_len = 4;
+
+  stream_mers(const std::string& path, file_header& header, int nb_threads, bool resume = false) :
+    path_(path), key_len_(header.key_len()), nb_threads_(nb_threads), resume_(false), header_len_(0)
+  {
+    header.format(binary_dumper::format);
+    header.counter_len(val_len);
+    if(resume) {
+      std::ifstream is(path_.c_str());
+      file_header   previous;
+      if(is.good() && previous.read(is)) {
+        resume_     = true;
+        header_len_ = previous.offset();
+        return;
+      }
+    }
+    std::ofstream os(path_.c_str());
+    header.write(os);
+    if(!os.good())
+      err::die(err::msg() << "Failed to write header of '" << path_ << "'");
+  }
+
+  class local {
+    const uint64_t    resumed_; // Records written before a resume
+    binary_mer_writer writer_;
+
+  public:
+    local(stream_mers& mers, int id, uint64_t resumed = 0) :
+      resumed_(mers.resume_ ? resumed : 0),
+      writer_(mers.open_segment(id, resumed_), mers.key_len_, val_len)
+    { }
+    template<typename mer_type>
+    void add(const mer_type& key, uint64_t val) { writer_.write(key, val); }
+    void done() { writer_.flush(); }
+
+    // Sync, for the records to outlast a crash as the checkpoint that
+    // counts them, and return the number of records written
+    uint64_t checkpoint() {
+      writer_.sync();
+      return resumed_ + writer_.nb_records();
+    }
+  };
+
+  // Copy the segments of threads 1..n-1 after the records of thread
+  // 0, one copying thread per segment, each at its final offset.
+  void finish() {
+    class segment_copier : public jellyfish::thread_exec {
+      const stream_mers&  mers_;
+      const int           out_;
+      std::vector<off_t>  offsets_;
+
+    public:
+      segment_copier(const stream_mers& mers, int out) : mers_(mers), out_(out), offsets_(mers.nb_threads_ + 1) {
+        struct stat st;
+        if(fstat(out_, &st) == -1)
+          err::die(err::msg() << "Failed to stat output file '" << mers_.path_ << "'" << err::no);
+        offsets_[1] = st.st_size;
+        for(int id = 1; id < mers_.nb_threads_; ++id) {
+          const std::string segment = mers_.segment_path(id);
+          if(stat(segment.c_str(), &st) == -1)
+            err::die(err::msg() << "Failed to stat segment file '" << segment << "'" << err::no);
+          offsets_[id + 1] = offsets_[id] + st.st_size;
+        }
+        if(ftruncate(out_, offsets_.back()) == -1)
+          err::die(err::msg() << "Failed to extend output file '" << mers_.path_ << "'" << err::no);
+      }
+
+      virtual void start(int thid) {
+        const int         id      = thid + 1;
+        const std::string segment = mers_.segment_path(id);
+        int               in      = open(segment.c_str(), O_RDONLY);
+        if(in == -1)
+          err::die(err::msg() << "Failed to open segment file '" << segment << "'" << err::no);
+        copy_to_offset(in, out_, offsets_[id], offsets_[id + 1] - offsets_[id]);
+        close(in);
+        unlink(segment.c_str());
+      }
+    };
+
+    if(nb_threads_ < 2)
+      return;
+    int            out = open_output(path_, O_WRONLY);
+    segment_copier copier(*this, out);
+    copier.exec_join(nb_threads_ - 1);
+    close(out);
+  }
+};
+
+// An input database. Compressed databases are detected from their
+// magic number and decompressed on the fly; they can only be read
+// sequentially, so their file_size is unknown (max). So are streams,
+// '-' for stdin or a named pipe, which are read once front to back:
+// their data after the header waits in stream_data for the single
+// reader of the merge.
+struct file_info {
+  static const size_t stream_buffer_size = 8 << 20;
+
+  std::string      path;
+  const bool       stream;
+  mapped_file      map; // Empty for a stream
+  compression_type compression;
+  file_header      header;
+  size_t           file_size;
+  size_t           readahead;          // Buffer size of the readahead thread, 0 to read the mapping
+  int              decompress_threads; // Threads decompressing each reader of a compressed input
+  unsigned         input;              // Logical input, summing the counts of a group of files
+  std::string      input_name;         // Name of the group, if given
+
+  // Progress of the merge readers, sampled by the progress reporter:
+  // bytes of the file read (compressed bytes if compressed), k-mers
+  // read, and the bytes the merge reads, the total of bytes_done: the
+  // whole file until the merge has located its position range, 0 if
+  // unknown (streams)
+  std::atomic<uint64_t> bytes_done;
+  std::atomic<uint64_t> kmers_done;
+  std::atomic<uint64_t> bytes_total;
+
+  std::unique_ptr<chunk_source> stream_data;
+
+  static bool is_stream(const char* p) {
+    struct stat st;
+    return !strcmp(p, "-") || (stat(p, &st) == 0 && S_ISFIFO(st.st_mode));
+  }
+
+  file_info(const char* p) :
+    path(p),
+    stream(is_stream(p)),
+    map(stream ? 0 : p),
+    compression(detect_compression(map.base(), map.size())),
+    file_size(compression || stream ? std::numeric_limits<size_t>::max() : map.size()),
+    readahead(0),
+    decompress_threads(1),
+    input(0),
+    bytes_done(0),
+    kmers_done(0),
+    bytes_total(0)
+  {
+    if(stream) {
+      chunk_streambuf buf(open_stream());
+      std::istream    is(&buf);
+      if(!header.read(is))
+        err::die(err::msg() << "Failed to read header of input '" << path << "'");
+      stream_data.reset(buf.release(header.offset()));
+      if(!stream_data)
+        err::die(err::msg() << "Failed to find the data after the header of input '" << path << "'");
+      return;
+    }
+    std::unique_ptr<std::streambuf> buf(open_streambuf(0));
+    std::istream                    is(buf.get());
+    if(!header.read(is))
+      err::die(err::msg() << "Failed to read header of input file '" << path << "'");
+    bytes_total = compressed() ? map.size() : map.size() - header.offset();
+  }
+
+  bool compressed() const { return compression != no_compression; }
+
+  // Whether a range of the records can be read on its own
+  bool seekable() const { return !compressed() && !stream; }
+
+  // Decompressed content, starting at offset
+  chunk_source* decompressed(size_t offset, std::atomic<uint64_t>* progress = 0) const {
+    return new decompress_source(compression, map.base(), map.end(), offset, decompress_threads, progress);
+  }
+
+  // The stream, from its start. Compressed streams would need their
+  // own decoder thread: they are better decompressed in the pipe.
+  chunk_source* open_stream() {
+    const int fd = strcmp(path.c_str(), "-") ? open(path.c_str(), O_RDONLY) : STDIN_FILENO;
+    if(fd == -1)
+      err::die(err::msg() << "Failed to open input '" << path << "'" << err::no);
+    std::unique_ptr<chunk_source> source(new pipe_source(path, fd, stream_buffer_size, &bytes_done));
+    const char *begin = 0, *end = 0;
+    if(source->next(begin, end) && detect_compression(begin, end - begin))
+      err::die(err::msg() << "Input '" << path << "' is compressed, decompress it in the pipe instead");
+    return new prefixed_source(source.release(), begin, end);
+  }
+
+  // The data of a stream, for the one reader that gets it
+  chunk_source* take_stream_data() {
+    if(!stream_data)
+      err::die(err::msg() << "Input '" << path << "' is a stream and can only be read once");
+    return stream_data.release();
+  }
+
+  // Stream buffer over the file content, positioned at offset (the
+  // data of a stream)
+  std::streambuf* open_streambuf(size_t offset) {
+    if(stream)
+      return new chunk_streambuf(take_stream_data());
+    if(compressed())
+      return new chunk_streambuf(decompressed(offset));
+    std::filebuf* buf = new std::filebuf;
+    if(!buf->open(path.c_str(), std::ios::in | std::ios::binary))
+      err::die(err::msg() << "Failed to open input file '" << path << "'" << err::no);
+    buf->pubseekpos(offset);
+    return buf;
+  }
+};
+
+
+// Bounds on the count of a k-mer in each logical input. K-mers out of
+// bounds are dropped as they come out of the merge, before the
+// histogram and the mers output.
+struct count_filter {
+  std::vector<uint64_t> min, max; // Per input, empty if no filter
+
+  bool active() const { return !min.empty(); }
+
+  // Inputs without a bound get [0, max]
+  void resize(unsigned nb_inputs) {
+    min.resize(nb_inputs, 0);
+    max.resize(nb_inputs, std::numeric_limits<uint64_t>::max());
+  }
+
+  bool pass(const uint64_t* counts) const {
+    for(size_t i = 0; i < min.size(); ++i)
+      if(counts[i] < min[i] || counts[i] > max[i])
+        return false;
+    return true;
+  }
+};
+
+struct common_info {
+  unsigned int            key_len;
+  size_t                  max_reprobe_offset;
+  size_t                  size;
+  unsigned int            out_counter_len;
+  std::string             format;
+  RectangularBinaryMatrix matrix;
+  size_t                  pos_begin; // Hash positions [pos_begin, pos_end) are merged,
+  size_t                  pos_end;   // [0, size) unless sharded
+  unsigned                nb_inputs; // Logical inputs, the files unless grouped (file_info::input)
+  count_filter            filter;
+  unsigned                strata;    // Ranges of a preview, at least one per thread; 0 if not a preview
+  double                  scale;     // Positions of the run (shard) per position merged
+
+  common_info(RectangularBinaryMatrix&& m) : matrix(std::move(m))
+  { }
+
+  // Merge only the index-th of count slices of the hash positions
+  void shard(size_t index, size_t count) {
+    pos_begin = size / count * index + std::min(index, size % count);
+    pos_end   = size / count * (index + 1) + std::min(index + 1, size % count);
+  }
+
+  // Merge only the first fraction of the positions, in strata. The
+  // positions are hashes of the k-mers, so these are random samples.
+  void preview(double fraction, unsigned nb_strata) {
+    const size_t span = pos_end - pos_begin;
+    const size_t kept = std::min(span, std::max((size_t)nb_strata, (size_t)(span * fraction)));
+    pos_end = pos_begin + kept;
+    scale   = (double)span / kept;
+    strata  = nb_strata;
+  }
+};
+
+inline common_info read_headers(int argc, char* input_files[], cpp_array<file_info>& files) {
+  // Read first file
+  files.init(0, input_files[0]);
+
+  file_header& h = files[0].header;
+  common_info res(h.matrix());
+  res.key_len            = h.key_len();
+  res.max_reprobe_offset = h.max_reprobe_offset();
+  res.size               = h.size();
+  res.pos_begin          = 0;
+  res.pos_end            = h.size();
+  res.nb_inputs          = argc;
+  res.strata             = 0;
+  res.scale              = 1;
+  res.format = h.format();
+  size_t reprobes[h.max_reprobe() + 1];
+  h.get_reprobes(reprobes);
+  res.out_counter_len = h.counter_len();
+
+  // Other files must match
+  for(int i = 1; i < argc; i++) {
+    files.init(i, input_files[i]);
+    files[i].input = i;
+    file_header& nh = files[i].header;
+    if(res.format != nh.format())
+      err::die(err::msg() << "Can't compare files with different formats (" << res.format << ", " << nh.format() << ")");
+    if(res.key_len != nh.key_len())
+      err::die(err::msg() << "Can't compare hashes of different key lengths (" << res.key_len << ", " << nh.key_len() << ")");
+    if(res.max_reprobe_offset != nh.max_reprobe_offset())
+      err::die("Can't compare hashes with different reprobing strategies");
+    if(res.size != nh.size())
+      err::die(err::msg() << "Can't compare hash with different size (" << res.size << ", " << nh.size() << ")");
+    if(res.matrix != nh.matrix())
+      err::die("Can't compare hash with different hash function");
+  }
+
+  return res;
+}
+
+// A reader_type over the bytes [offset, end) of a file. Stream based
+// readers get their own stream and may read past end. The chunk
+// readers read from the mapping shared by all threads. The readers of
+// the merge (track) read from their own readahead thread instead when
+// file.readahead is set and the range spans more than one buffer, and
+// count the bytes they read in file.bytes_done; the probes of a binary
+// search read one record and don't. Compressed files are decompressed
+// from the start, skipping to offset.
+template<typename reader_type>
+struct reader_source {
+  std::unique_ptr<std::streambuf> buf_;
+  std::istream                    is_;
+  reader_type                     reader_;
+
+  reader_source(file_info& file, size_t offset, size_t, bool = false) :
+    buf_(file.open_streambuf(offset)),
+    is_(buf_.get()),
+    reader_(is_, &file.header)
+  { }
+};
+
+template<typename reader_type>
+struct chunk_reader_source {
+  reader_type reader_;
+
+  static chunk_source* make_source(file_info& file, size_t offset, size_t end, bool track) {
+    std::atomic<uint64_t>* progress = track ? &file.bytes_done : 0;
+    if(file.stream)
+      return file.take_stream_data();
+    if(file.compressed())
+      return file.decompressed(offset, progress);
+    if(track && file.readahead && end - offset > file.readahead)
+      return new readahead_source(file.path, offset, end, file.readahead, progress);
+    return new mapped_chunk_source(file.map.base() + offset, file.map.base() + end, progress);
+  }
+
+  chunk_reader_source(file_info& file, size_t offset, size_t end, bool track = false) :
+    reader_(make_source(file, offset, end, track), &file.header)
+  { }
+};
+
+template<typename mer_type>
+struct reader_source<basic_binary_chunk_reader<mer_type> > : chunk_reader_source<basic_binary_chunk_reader<mer_type> > {
+  using chunk_reader_source<basic_binary_chunk_reader<mer_type> >::chunk_reader_source;
+};
+
+template<typename mer_type>
+struct reader_source<basic_text_chunk_reader<mer_type> > : chunk_reader_source<basic_text_chunk_reader<mer_type> > {
+  using chunk_reader_source<basic_text_chunk_reader<mer_type> >::chunk_reader_source;
+};
+
+// Type of the keys of a reader_type
+template<typename reader_type>
+struct reader_key {
+  typedef typename std::decay<decltype(std::declval<reader_type>().key())>::type type;
+};
+
+// Locates the first record of a file whose hash position is >= a
+// given position. Records are sorted by hash position, so a binary
+// search over record start offsets avoids scanning the file. For
+// the binary format records have a fixed size; for the text format
+// an arbitrary byte offset is resynchronized to the next line start.
+template<typename reader_type>
+struct record_locator {
+  file_info&   file_;
+  const bool   fixed_;
+  const size_t record_len_;
+  const size_t data_start_;
+
+  record_locator(file_info& file, bool fixed) :
+    file_(file), fixed_(fixed),
+    record_len_((file.header.key_len() + 7) / 8 + file.header.counter_len()),
+    data_start_(file.header.offset())
+  { }
+
+  // Start offset of the first record at or after byte offset off
+  size_t start_at(std::ifstream& is, size_t off) const {
+    if(fixed_ || off == data_start_)
+      return off;
+    is.clear();
+    is.seekg(off - 1);
+    is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    return is.good() ? (size_t)is.tellg() : file_.file_size;
+  }
+
+  // Hash position of the record starting at off, or max if at end of file
+  size_t pos_at(size_t off) const {
+    if(off >= file_.file_size)
+      return std::numeric_limits<size_t>::max();
+    reader_source<reader_type> source(file_, off, fixed_ ? off + record_len_ : file_.file_size);
+    return source.reader_.next() ? source.reader_.pos() : std::numeric_limits<size_t>::max();
+  }
+
+  size_t lower_bound(size_t pos) const {
+    if(pos == 0)
+      return data_start_;
+    if(fixed_) {
+      size_t lo = 0, hi = (file_.file_size - data_start_) / record_len_;
+      while(lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if(pos_at(data_start_ + mid * record_len_) < pos)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      return data_start_ + lo * record_len_;
+    }
+    std::ifstream is(file_.path.c_str());
+    size_t        lo = data_start_, hi = file_.file_size;
+    while(lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if(pos_at(start_at(is, mid)) < pos)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return start_at(is, lo);
+  }
+};
+
+// Reader restricted to records with hash position in [begin, end)
+// of a file, stored in the bytes [offset, end_offset). Records before
+// begin are skipped, for compressed files read from their start.
+template<typename reader_type>
+class range_reader : reader_source<reader_type> {
+  typedef typename reader_key<reader_type>::type mer_type;
+  static const uint64_t progress_step = 1 << 16; // Records between updates of file.kmers_done
+
+  std::atomic<uint64_t>& kmers_done_;
+  const size_t           begin_;
+  const size_t           end_;
+  size_t                 pos_;
+  uint64_t               nb_records_;
+  bool                   head_; // The last record read is in the range
+
+public:
+  range_reader(file_info& file, size_t offset, size_t end_offset, size_t begin, size_t end) :
+    reader_source<reader_type>(file, offset, end_offset, true),
+    kmers_done_(file.kmers_done),
+    begin_(begin),
+    end_(end),
+    pos_(0),
+    nb_records_(0),
+    head_(false)
+  { }
+
+  ~range_reader() {
+    kmers_done_.fetch_add(nb_records_ % progress_step, std::memory_order_relaxed);
+  }
+
+  // Records read in the range
+  uint64_t nb_records() const { return nb_records_; }
+  // Records read in the range and consumed, all but the current one
+  uint64_t nb_consumed() const { return nb_records_ - head_; }
+
+  const mer_type& key() const { return this->reader_.key(); }
+  const uint64_t& val() const { return this->reader_.val(); }
+  size_t pos() const { return pos_; }
+  bool next() {
+    head_ = false;
+    do {
+      if(!this->reader_.next())
+        return false;
+      pos_ = this->reader_.pos();
+    } while(pos_ < begin_);
+    if(pos_ >= end_)
+      return false;
+    head_ = true;
+    if(++nb_records_ % progress_step == 0)
+      kmers_done_.fetch_add(progress_step, std::memory_order_relaxed);
+    return true;
+  }
+};
+
+// Merges the files over disjoint hash position ranges, one per
+// thread (or more for the strata of a preview, taken in turn by the
+// threads), each with its own readers and histogram of counts. Each
+// range is checkpointed and resumed on its own. The counts of the
+// files of a group are summed into the count of their logical input
+// as the k-mers come out of the tree.
+template<typename reader_type, typename histogram_type, typename mer_sink>
+class merge_ranges : public jellyfish::thread_exec {
+  typedef typename reader_key<reader_type>::type mer_type;
+  typedef range_reader<reader_type>              iterator_type;
+  typedef loser_tree<mer_type, iterator_type>    tree_type;
+  typedef typename histogram_type::shape         shape_type;
+  typedef std::chrono::steady_clock              clock;
+  static const uint64_t checkpoint_step = 1 << 16; // k-mers between checks of the checkpoint clock
+
+  cpp_array<file_info>&     files_;
+  const unsigned            nb_inputs_;
+  const bool                grouped_;
+  const count_filter        filter_;
+  mer_sink&                 mers_;
+  const shape_type          shape_;
+  const checkpoint_config   ckpt_;
+  const int                 nb_threads_;
+  const int                 nb_ranges_; // One per thread, or the strata of a preview
+  std::vector<size_t>       bounds_;
+  std::vector<size_t>       offsets_;
+  std::vector<size_t>       resume_;         // Position where each range resumes, its bound if not resumed
+  std::vector<size_t>       resume_offsets_; // And its offset in file i, at t * nb files + i
+  std::vector<uint64_t>     resume_mers_;    // Mers written by each range before resuming
+  cpp_array<histogram_type> partials_;
+  std::vector<uint64_t>     records_;  // Records read by range t in file i, at t * nb files + i
+  std::vector<uint64_t>     comparisons_; // Key comparisons of the tree of each range, in this run
+  std::vector<uint64_t>     distinct_; // Distinct k-mers merged by each range
+
+  // All k-mers of range id before resume_pos are merged. The current
+  // record of each reader is not and is read again on resume.
+  void checkpoint(int id, size_t resume_pos, const cpp_array<iterator_type>& readers,
+                  typename mer_sink::local& mers, uint64_t distinct) {
+    range_checkpoint c;
+    c.begin        = bounds_[id];
+    c.end          = bounds_[id + 1];
+    c.resume_pos   = resume_pos;
+    c.distinct     = distinct;
+    c.mers_records = mers.checkpoint();
+    for(size_t i = 0; i < files_.size(); ++i) {
+      c.records.push_back(records_[id * files_.size() + i] + readers[i].nb_consumed());
+      c.file_sizes.push_back(files_[i].map.size());
+    }
+    c.write(ckpt_.path(id), partials_[id]);
+  }
+
+  // Load the checkpoint of range id, if any, and check it is of this merge
+  void resume(int id) {
+    range_checkpoint c;
+    if(!c.read(ckpt_.path(id), partials_[id]))
+      return;
+    bool same = c.begin == bounds_[id] && c.end == bounds_[id + 1] && c.records.size() == files_.size();
+    for(size_t i = 0; same && i < files_.size(); ++i)
+      same = c.file_sizes[i] == files_[i].map.size();
+    if(!same || c.resume_pos < c.begin || c.resume_pos > c.end)
+      err::die(err::msg() << "Checkpoint '" << ckpt_.path(id) << "' is of another merge, resume with the same "
+               "inputs, --threads and --shard");
+    resume_[id]      = c.resume_pos;
+    distinct_[id]    = c.distinct;
+    resume_mers_[id] = c.mers_records;
+    for(size_t i = 0; i < files_.size(); ++i)
+      records_[id * files_.size() + i] = c.records[i];
+  }
+
+public:
+  merge_ranges(cpp_array<file_info>& files, const common_info& cinfo, mer_sink& mers,
+               const shape_type& shape, int nb_threads, const checkpoint_config& ckpt = checkpoint_config()) :
+    files_(files), nb_inputs_(cinfo.nb_inputs), grouped_(cinfo.nb_inputs != files.size()), filter_(cinfo.filter),
+    mers_(mers), shape_(shape), ckpt_(ckpt),
+    nb_threads_(nb_threads), nb_ranges_(std::max(nb_threads, (int)cinfo.strata)),
+    bounds_(nb_ranges_ + 1), offsets_((nb_ranges_ + 1) * files.size()),
+    resume_(nb_ranges_), resume_offsets_(nb_ranges_ * files.size()), resume_mers_(nb_ranges_, 0),
+    partials_(nb_ranges_), records_(nb_ranges_ * files.size(), 0),
+    comparisons_(nb_ranges_, 0), distinct_(nb_ranges_, 0)
+  {
+    // Split the merged positions evenly and find where each range
+    // starts in every file. The last range ends with the file, or
+    // where the next shard starts. Compressed files and streams can't
+    // seek and are read from the start.
+    const size_t span = cinfo.pos_end - cinfo.pos_begin;
+    for(int t = 0; t <= nb_ranges_; ++t)
+      bounds_[t] = cinfo.pos_begin + span / nb_ranges_ * t + std::min((size_t)t, span % nb_ranges_);
+    const bool fixed = cinfo.format == binary_dumper::format;
+    for(size_t i = 0; i < files.size(); ++i) {
+      if(!files[i].seekable()) {
+        for(int t = 0; t < nb_ranges_; ++t)
+          offsets_[t * files.size() + i] = files[i].header.offset();
+        offsets_[nb_ranges_ * files.size() + i] = files[i].file_size;
+        continue;
+      }
+      record_locator<reader_type> locator(files[i], fixed);
+      for(int t = 0; t < nb_ranges_; ++t)
+        offsets_[t * files.size() + i] = locator.lower_bound(bounds_[t]);
+      offsets_[nb_ranges_ * files.size() + i] =
+        cinfo.pos_end < cinfo.size ? locator.lower_bound(cinfo.pos_end) : files[i].file_size;
+    }
+
+    for(int t = 0; t < nb_ranges_; ++t) {
+      partials_.init(t, shape_);
+      resume_[t] = bounds_[t];
+      if(ckpt_.resume)
+        resume(t);
+    }
+    for(size_t i = 0; i < files.size(); ++i) {
+      record_locator<reader_type> locator(files[i], fixed);
+      uint64_t                    bytes_total = 0;
+      for(int t = 0; t < nb_ranges_; ++t) {
+        size_t& offset = resume_offsets_[t * files.size() + i];
+        offset         = offsets_[t * files.size() + i];
+        if(resume_[t] != bounds_[t] && files[i].seekable())
+          offset = locator.lower_bound(resume_[t]);
+        bytes_total += offsets_[(t + 1) * files.size() + i] - offset;
+      }
+      if(files[i].seekable())
+        files[i].bytes_total = bytes_total;
+    }
+  }
+
+private:
+  // Merge loop, instantiated without the filter unless there is one
+  template<bool filtered>
+  void merge(int id) {
+    const size_t             num_files = files_.size();
+    cpp_array<iterator_type> readers(num_files);
+    histogram_type&          coverage_count = partials_[id];
+
+    for(size_t i = 0; i < num_files; ++i)
+      readers.init(i, files_[i], resume_offsets_[id * num_files + i], offsets_[(id + 1) * num_files + i],
+                   resume_[id], bounds_[id + 1]);
+
+    tree_type tree(&readers[0], num_files);
+    mer_type  key;
+    uint64_t  counts[num_files];
+    uint64_t  input_counts[nb_inputs_];
+    typename mer_sink::local mers(mers_, id, resume_mers_[id]);
+    uint64_t                 distinct = distinct_[id];
+
+    // A due checkpoint is taken when the merge moves to the next hash
+    // position, as all k-mers of the previous ones are then merged.
+    const bool              checkpoints = ckpt_.interval > 0;
+    const clock::duration   interval    =
+      std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(ckpt_.interval));
+    clock::time_point       next_checkpoint = clock::now() + interval;
+    bool                    due             = false;
+    size_t                  pos             = std::numeric_limits<size_t>::max();
+
+    while(tree.is_not_empty()) {
+      if(due && tree.pos() != pos) {
+        checkpoint(id, tree.pos(), readers, mers, distinct);
+        due             = false;
+        next_checkpoint = clock::now() + interval;
+      }
+      pos = tree.pos();
+
+      // Collect the counts of the smallest key in every file
+      tree.pop(key, counts);
+      ++distinct;
+
+      const uint64_t* merged = counts;
+      if(grouped_) {
+        memset(input_counts, '\0', sizeof(uint64_t) * nb_inputs_);
+        for(size_t i = 0; i < num_files; ++i)
+          input_counts[files_[i].input] += counts[i];
+        merged = input_counts;
+      }
+
+      // Assembly counts in slot 1, read counts in the following ones
+      if(!filtered || filter_.pass(merged)) {
+        coverage_count.add(merged);
+        mers.add(key, merged[0]);
+      }
+
+      if(checkpoints && distinct % checkpoint_step == 0 && clock::now() >= next_checkpoint)
+        due = true;
+    }
+    mers.done();
+    if(checkpoints)
+      checkpoint(id, bounds_[id + 1], readers, mers, distinct);
+
+    distinct_[id]    = distinct;
+    comparisons_[id] = tree.comparisons();
+    for(size_t i = 0; i < num_files; ++i)
+      records_[id * num_files + i] += readers[i].nb_records();
+  }
+
+public:
+  virtual void start(int thid) {
+    for(int id = thid; id < nb_ranges_; id += nb_threads_) {
+      if(filter_.active())
+        merge<true>(id);
+      else
+        merge<false>(id);
+    }
+  }
+
+  int nb_ranges() const { return nb_ranges_; }
+  const histogram_type& partial(int id) const { return partials_[id]; }
+
+  // Counters of the merge, the k-mers including those merged before a
+  // resume. The bytes read and the comparisons are those of this run:
+  // the bytes the readers got from each file (compressed bytes if
+  // compressed), as counted for the progress reporter.
+  void report(run_stats& stats) const {
+    const size_t nb_files = files_.size();
+    stats.inputs.resize(nb_files);
+    stats.distinct_kmers = 0;
+    for(uint64_t d : distinct_)
+      stats.distinct_kmers += d;
+    stats.tree_replays = 0;
+    for(size_t i = 0; i < nb_files; ++i) {
+      input_stats& input = stats.inputs[i];
+      input.path         = files_[i].path;
+      input.input        = files_[i].input;
+      input.compressed   = files_[i].compressed();
+      input.bytes_read   = files_[i].bytes_done;
+      input.kmers_read   = 0;
+      for(size_t t = 0; t < distinct_.size(); ++t)
+        input.kmers_read += records_[t * nb_files + i];
+      stats.tree_replays += input.kmers_read;
+    }
+    stats.tree_comparisons = 0;
+    for(uint64_t c : comparisons_)
+      stats.tree_comparisons += c;
+  }
+
+  // Sum the per range histograms into the first one
+  histogram_type& reduce() {
+    histogram_type& res = partials_[0];
+    for(size_t t = 1; t < partials_.size(); ++t) {
+      res += partials_[t];
+      partials_.release(t);
+    }
+    return res;
+  }
+};
+
+// What to write once the counts are merged
+struct output_config {
+  std::string               prefix;
+  coverage_histogram::shape cap;    // dense cap of the 2D histograms
+  bool                      sorted; // rows sorted by counts
+  bool                      npy;    // .npy files alongside the TSV
+  bool                      partial; // prefix.khist alongside the TSV
+};
+
+// Write a histogram as TSV rows: the count in each input followed by
+// the number of k-mers with these counts.
+inline void write_tsv(const coverage_histogram& hist, const std::string& path, bool sorted) {
+  tsv_writer out(path);
+  auto row = [&](uint64_t x, uint64_t y, uint64_t n) {
+    out.put(x, '\t');
+    out.put(y, '\t');
+    out.put(n, '\n');
+  };
+  if(sorted)
+    hist.for_each_sorted(row);
+  else
+    hist.for_each(row);
+}
+
+inline void write_tsv(const joint_histogram& hist, const std::string& path, bool sorted) {
+  tsv_writer out(path);
+  auto row = [&](const uint64_t* counts, uint64_t n) {
+    for(unsigned i = 0; i < hist.dims(); ++i)
+      out.put(counts[i], '\t');
+    out.put(n, '\n');
+  };
+  if(sorted)
+    hist.for_each_sorted(row);
+  else
+    hist.for_each(row);
+}
+
+// Write a 2D histogram as numpy arrays: prefix.npy holds the dense
+// matrix, n for x <= max_x and y <= max_y at [x, y], and prefix_coo.npy
+// the cells beyond it as rows (x, y, n).
+inline void write_npy(const coverage_histogram& hist, const std::string& prefix) {
+  {
+    npy_writer dense(prefix + ".npy", { hist.max_x() + 1, hist.max_y() + 1 });
+    dense.put(hist.dense(), (hist.max_x() + 1) * (hist.max_y() + 1));
+  }
+  npy_writer coo(prefix + "_coo.npy", { hist.nb_overflow(), 3 });
+  hist.for_each_overflow([&](uint64_t x, uint64_t y, uint64_t n) {
+      coo.put(x);
+      coo.put(y);
+      coo.put(n);
+    });
+}
+
+// Write an N-d histogram as the numpy array prefix_coo.npy of rows
+// (count 0, ..., count N-1, n).
+inline void write_npy(const joint_histogram& hist, const std::string& prefix, bool sorted) {
+  npy_writer coo(prefix + "_coo.npy", { hist.size(), hist.dims() + 1 });
+  auto row = [&](const uint64_t* counts, uint64_t n) {
+    for(unsigned i = 0; i < hist.dims(); ++i)
+      coo.put(counts[i]);
+    coo.put(n);
+  };
+  if(sorted)
+    hist.for_each_sorted(row);
+  else
+    hist.for_each(row);
+}
+
+// Two inputs: prefix.tsv holds the 2D histogram
+inline void write_counts(const coverage_histogram& hist, const output_config& out) {
+  write_tsv(hist, out.prefix + ".tsv", out.sorted);
+  if(out.partial)
+    write_partial(hist, out.prefix + ".khist");
+  if(out.npy)
+    write_npy(hist, out.prefix);
+}
+
+// N inputs: prefix.tsv holds the N-d histogram and prefix_i_j.tsv the
+// 2D marginal of inputs i < j.
+inline void write_counts(const joint_histogram& hist, const output_config& out) {
+  write_tsv(hist, out.prefix + ".tsv", out.sorted);
+  if(out.partial)
+    write_partial(hist, out.prefix + ".khist");
+  if(out.npy)
+    write_npy(hist, out.prefix, out.sorted);
+  for(unsigned i = 0; i < hist.dims(); ++i) {
+    for(unsigned j = i + 1; j < hist.dims(); ++j) {
+      coverage_histogram marginal(out.cap);
+      hist.marginal(i, j, marginal);
+      const std::string prefix = out.prefix + "_" + std::to_string(i) + "_" + std::to_string(j);
+      write_tsv(marginal, prefix + ".tsv", out.sorted);
+      if(out.npy)
+        write_npy(marginal, prefix);
+    }
+  }
+}
+
+// Add the square of every cell of from to to
+inline void add_squares(const coverage_histogram& from, coverage_histogram& to) {
+  from.for_each([&](uint64_t x, uint64_t y, uint64_t n) { to.add(x, y, n * n); });
+}
+
+inline void add_squares(const joint_histogram& from, joint_histogram& to) {
+  from.for_each([&](const uint64_t* counts, uint64_t n) { to.add(counts, n * n); });
+}
+
+// Estimate of a cell of a preview, from sum and squares, the sum and
+// the sum of the squares of its counts in nb_strata strata, each a
+// random sample of the same number of positions. Writes the estimate
+// and its 95% confidence interval, from the variance between strata,
+// with the finite population correction (none at fraction 1).
+inline void write_estimate(tsv_writer& out, uint64_t sum, uint64_t squares, unsigned nb_strata, double scale) {
+  // 0.975 quantiles of Student's t distribution, 1 to 30 degrees of freedom
+  static const double t975[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+    2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+  const unsigned df       = nb_strata - 1;
+  const double   t        = df <= 30 ? t975[df - 1] : 1.96;
+  const double   mean     = (double)sum / nb_strata;
+  const double   variance = std::max(0.0, ((double)squares - mean * sum) / df);
+  const double   estimate = scale * sum;
+  const double   margin   = t * scale * std::sqrt(nb_strata * variance * (1 - 1 / scale));
+  out.put(llround(estimate), '\t');
+  out.put(llround(std::max((double)sum, estimate - margin)), '\t');
+  out.put(llround(estimate + margin), '\n');
+}
+
+// Write the estimates of the cells of a preview, as rows of counts,
+// estimate, low and high bounds of the 95% confidence interval
+inline void write_preview(const coverage_histogram& sum, const coverage_histogram& squares, unsigned nb_strata,
+                          double scale, const std::string& path, bool sorted) {
+  tsv_writer out(path);
+  auto row = [&](uint64_t x, uint64_t y, uint64_t n) {
+    out.put(x, '\t');
+    out.put(y, '\t');
+    write_estimate(out, n, squares.at(x, y), nb_strata, scale);
+  };
+  if(sorted)
+    sum.for_each_sorted(row);
+  else
+    sum.for_each(row);
+}
+
+inline void write_preview(const joint_histogram& sum, const joint_histogram& squares, unsigned nb_strata,
+                          double scale, const std::string& path, bool sorted) {
+  tsv_writer out(path);
+  auto row = [&](const uint64_t* counts, uint64_t n) {
+    for(unsigned i = 0; i < sum.dims(); ++i)
+      out.put(counts[i], '\t');
+    write_estimate(out, n, squares.at(counts), nb_strata, scale);
+  };
+  if(sorted)
+    sum.for_each_sorted(row);
+  else
+    sum.for_each(row);
+}
+
+// Sum the partial histograms of paths, each the .khist of a merge of
+// a part of the k-mers, and write the result as write_counts. Linear
+// in the number of cells.
+template<typename histogram_type>
+void merge_partials(const std::vector<std::string>& paths, unsigned dims,
+                    const typename histogram_type::shape& shape, const output_config& out, run_stats& stats) {
+  histogram_type hist(shape);
+  {
+    phase_timer timer(stats, "histogram");
+    for(const auto& path : paths) {
+      partial_histogram_file partial(path);
+      if(partial.dims() != dims)
+        err::die(err::msg() << "Partial histogram '" << path << "' has " << partial.dims()
+                 << " inputs, expected " << dims << " as '" << paths[0] << "'");
+      partial.add_to(hist);
+    }
+  }
+  {
+    phase_timer timer(stats, "write_tsv");
+    write_counts(hist, out);
+  }
+}
+
+inline void merge_partials(const std::vector<std::string>& paths, const output_config& out, run_stats& stats) {
+  const unsigned dims = partial_histogram_file(paths[0]).dims();
+  if(dims == 2) {
+    merge_partials<coverage_histogram>(paths, dims, out.cap, out, stats);
+  } else {
+    const joint_histogram::shape shape = { dims };
+    merge_partials<joint_histogram>(paths, dims, shape, out, stats);
+  }
+}
+
+// Phases of the merge are timed in stats. The merge phase includes
+// filling the per range histograms and streaming the mers; the
+// histogram phase sums the per range histograms.
+template<typename reader_type, typename histogram_type, typename mer_sink>
+void merge_counts(cpp_array<file_info>& files, const common_info& cinfo, mer_sink& mers,
+                  const typename histogram_type::shape& shape, const output_config& out,
+                  const checkpoint_config& ckpt, int nb_threads, run_stats& stats) {
+  std::unique_ptr<merge_ranges<reader_type, histogram_type, mer_sink> > merger;
+  {
+    phase_timer timer(stats, "locate_ranges");
+    merger.reset(new merge_ranges<reader_type, histogram_type, mer_sink>(files, cinfo, mers, shape, nb_threads, ckpt));
+  }
+  {
+    phase_timer timer(stats, "merge");
+    merger->exec_join(nb_threads);
+  }
+  histogram_type*                 hist;
+  std::unique_ptr<histogram_type> squares; // Of the strata of a preview
+  {
+    phase_timer timer(stats, "histogram");
+    if(cinfo.strata && merger->nb_ranges() > 1) {
+      squares.reset(new histogram_type(shape));
+      for(int r = 0; r < merger->nb_ranges(); ++r)
+        add_squares(merger->partial(r), *squares);
+    }
+    hist = &merger->reduce();
+  }
+  {
+    phase_timer timer(stats, "write_tsv");
+    if(squares)
+      write_preview(*hist, *squares, merger->nb_ranges(), cinfo.scale, out.prefix + "_ci.tsv", out.sorted);
+    if(cinfo.scale != 1)
+      hist->scale(cinfo.scale);
+    write_counts(*hist, out);
+  }
+  merger->report(stats);
+}
+
+template<typename reader_type, typename mer_sink>
+void output_counts(cpp_array<file_info>& files, const common_info& cinfo, mer_sink& mers,
+                   const output_config& out, const checkpoint_config& ckpt, int nb_threads, run_stats& stats) {
+  if(cinfo.nb_inputs == 2) {
+    merge_counts<reader_type, coverage_histogram>(files, cinfo, mers, out.cap, out, ckpt, nb_threads, stats);
+  } else {
+    const joint_histogram::shape shape = { cinfo.nb_inputs };
+    merge_counts<reader_type, joint_histogram>(files, cinfo, mers, shape, out, ckpt, nb_threads, stats);
+  }
+}
+
+template<typename mer_type, typename mer_sink>
+void output_counts_mer(cpp_array<file_info>& files, const common_info& cinfo, mer_sink& mers,
+                       const output_config& out, const checkpoint_config& ckpt, int nb_threads, run_stats& stats) {
+  if(cinfo.format == binary_dumper::format)
+    output_counts<basic_binary_chunk_reader<mer_type> >(files, cinfo, mers, out, ckpt, nb_threads, stats);
+  else
+    output_counts<basic_text_chunk_reader<mer_type> >(files, cinfo, mers, out, ckpt, nb_threads, stats);
+}
+
+// The merge is instantiated with the key held inline for common k,
+// with mer_dna for any other.
+template<typename mer_sink>
+void output_counts(cpp_array<file_info>& files, const common_info& cinfo, mer_sink& mers,
+                   const output_config& out, const checkpoint_config& ckpt, int nb_threads, run_stats& stats) {
+  if(cinfo.format != binary_dumper::format && cinfo.format != text_dumper::format)
+    err::die(err::msg() << "Format '" << cinfo.format << "' not supported\n");
+  switch(cinfo.key_len / 2) {
+  case 17: output_counts_mer<static_mer<17> >(files, cinfo, mers, out, ckpt, nb_threads, stats); break;
+  case 21: output_counts_mer<static_mer<21> >(files, cinfo, mers, out, ckpt, nb_threads, stats); break;
+  case 25: output_counts_mer<static_mer<25> >(files, cinfo, mers, out, ckpt, nb_threads, stats); break;
+  case 31: output_counts_mer<static_mer<31> >(files, cinfo, mers, out, ckpt, nb_threads, stats); break;
+  case 51: output_counts_mer<static_mer<51> >(files, cinfo, mers, out, ckpt, nb_threads, stats); break;
+  case 63: output_counts_mer<static_mer<63> >(files, cinfo, mers, out, ckpt, nb_threads, stats); break;
+  default: output_counts_mer<mer_dna>(files, cinfo, mers, out, ckpt, nb_threads, stats);
+  }
+}
+
+#endif /* __KMER_UTILS_KMER_COUNT_PAIRS_HPP__ */
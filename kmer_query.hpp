@@ -0,0 +1,253 @@
+/**
+ * @file   kmer_query.hpp
+ *
+ * @brief Counts of a batch of k-mers in jellyfish databases
+ *
+ * The queries are sorted by hash position, as the records of the
+ * databases, and answered in one forward pass over each database.
+ * Where the next query is far ahead of the pass, the pass jumps to it
+ * with a binary search over the records instead of reading the records
+ * in between. The threads answer disjoint runs of the sorted queries.
+ *
+ */
+#ifndef __KMER_UTILS_KMER_QUERY_HPP__
+#define __KMER_UTILS_KMER_QUERY_HPP__
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <jellyfish/err.hpp>
+#include <jellyfish/thread_exec.hpp>
+
+#include "kmer_count_pairs.hpp"
+
+// The k-mers queried, in input order, as given (upper cased)
+struct query_list {
+  const unsigned k;
+  std::string    bases; // k per query
+
+  explicit query_list(unsigned k_) : k(k_) { }
+
+  size_t size() const { return bases.size() / k; }
+  const char* at(size_t q) const { return bases.data() + q * k; }
+
+  static bool is_base(char c) { return c == 'A' || c == 'C' || c == 'G' || c == 'T'; }
+
+  // Read a list of k-mers, one per line, or the FASTA records of is,
+  // every k-mer of their sequences being queried but those with other
+  // bases than ACGT
+  void read(std::istream& is) {
+    std::string line, seq;
+    bool        fasta = false;
+    for(size_t nb = 1; std::getline(is, line); ++nb) {
+      if(!line.empty() && line.back() == '\r')
+        line.pop_back();
+      std::transform(line.begin(), line.end(), line.begin(), ::toupper);
+      if(nb == 1 && !line.empty() && line[0] == '>')
+        fasta = true;
+      if(fasta) {
+        if(!line.empty() && line[0] == '>') {
+          add_kmers(seq);
+          seq.clear();
+        } else {
+          seq += line;
+        }
+        continue;
+      }
+      const size_t start = line.find_first_not_of(" \t");
+      if(start == std::string::npos)
+        continue;
+      const size_t end = std::min(line.size(), line.find_first_of(" \t", start));
+      if(end - start != k || !std::all_of(line.begin() + start, line.begin() + end, is_base))
+        jellyfish::err::die(jellyfish::err::msg() << "Invalid " << k << "-mer on line " << nb << " of the queries");
+      bases.append(line, start, k);
+    }
+    add_kmers(seq);
+  }
+
+  // Add every k-mer of seq made of ACGT only
+  void add_kmers(const std::string& seq) {
+    size_t valid = 0; // ACGT bases ending at i
+    for(size_t i = 0; i < seq.size(); ++i) {
+      valid = is_base(seq[i]) ? valid + 1 : 0;
+      if(valid >= k)
+        bases.append(seq, i + 1 - k, k);
+    }
+  }
+};
+
+// Canonical form of the k bases at s in buf: the smaller of the k-mer
+// and its reverse complement, as jellyfish -C stores it
+inline const char* canonical_bases(const char* s, unsigned k, std::string& buf) {
+  buf.resize(k);
+  for(unsigned i = 0; i < k; ++i) {
+    switch(s[k - 1 - i]) {
+    case 'A': buf[i] = 'T'; break;
+    case 'C': buf[i] = 'G'; break;
+    case 'G': buf[i] = 'C'; break;
+    default:  buf[i] = 'A'; break;
+    }
+  }
+  return memcmp(buf.data(), s, k) < 0 ? buf.data() : s;
+}
+
+template<typename reader_type>
+class query_engine : public jellyfish::thread_exec {
+  typedef typename reader_key<reader_type>::type mer_type;
+  typedef range_reader<reader_type>              iterator_type;
+  // Gap of records beyond which a pass seeks to the next query: a few
+  // pages, about what the last steps of a binary search touch
+  static const size_t seek_bytes = 16 << 10;
+
+  struct query {
+    size_t   pos;
+    mer_type key;
+    size_t   index; // In the query_list
+
+    bool operator<(const query& rhs) const {
+      return pos < rhs.pos || (pos == rhs.pos && key < rhs.key);
+    }
+  };
+
+  cpp_array<file_info>& files_;
+  const common_info&    cinfo_;
+  std::vector<query>    queries_;  // Sorted by position and key
+  std::vector<size_t>   bounds_;   // Thread t answers the queries [bounds_[t], bounds_[t + 1])
+  std::vector<uint64_t> counts_;   // Count of query q in input i, at q * nb inputs + i
+  std::vector<uint64_t> records_;  // Records read in file i by thread t, at t * nb files + i
+
+  // Answer the queries [qb, qe) in file i
+  void answer(int thid, size_t i, size_t qb, size_t qe) {
+    file_info&                  file     = files_[i];
+    const bool                  seekable = file.seekable();
+    record_locator<reader_type> locator(file, cinfo_.format == binary_dumper::format);
+    // Hash positions spanning seek_bytes of records, on average
+    const double   bytes_per_pos = (double)(file.map.size() - file.header.offset()) / cinfo_.size;
+    const size_t   seek_gap      = bytes_per_pos > 0 ? seek_bytes / bytes_per_pos : cinfo_.size;
+    const unsigned nb_inputs     = cinfo_.nb_inputs;
+
+    for(size_t q = qb; q < qe; ) {
+      const size_t  offset = seekable ? locator.lower_bound(queries_[q].pos) : file.header.offset();
+      iterator_type reader(file, offset, file.file_size, queries_[q].pos, cinfo_.size);
+      bool          more = reader.next();
+      for( ; q < qe; ++q) {
+        const query& cur = queries_[q];
+        if(seekable && more && cur.pos > reader.pos() + seek_gap)
+          break;
+        while(more && (reader.pos() < cur.pos || (reader.pos() == cur.pos && reader.key() < cur.key)))
+          more = reader.next();
+        if(more && reader.pos() == cur.pos && reader.key() == cur.key)
+          counts_[cur.index * nb_inputs + file.input] += reader.val();
+      }
+      records_[thid * files_.size() + i] += reader.nb_records();
+    }
+  }
+
+public:
+  query_engine(cpp_array<file_info>& files, const common_info& cinfo, const query_list& list, int nb_threads) :
+    files_(files), cinfo_(cinfo),
+    bounds_(nb_threads + 1),
+    counts_(list.size() * cinfo.nb_inputs, 0),
+    records_(nb_threads * files.size(), 0)
+  {
+    const jellyfish::RectangularBinaryMatrix& m         = cinfo.matrix;
+    const bool                                canonical = files[0].header.canonical();
+    std::string                               buf;
+    queries_.reserve(list.size());
+    for(size_t q = 0; q < list.size(); ++q) {
+      query cur = { 0, mer_type(list.k), q };
+      pack_mer(canonical ? canonical_bases(list.at(q), list.k, buf) : list.at(q), list.k, cur.key);
+      cur.pos = m.times(cur.key) & (cinfo.size - 1);
+      queries_.push_back(cur);
+    }
+    std::sort(queries_.begin(), queries_.end());
+    for(int t = 0; t <= nb_threads; ++t)
+      bounds_[t] = queries_.size() / nb_threads * t + std::min((size_t)t, queries_.size() % nb_threads);
+  }
+
+  virtual void start(int thid) {
+    if(bounds_[thid] == bounds_[thid + 1])
+      return;
+    for(size_t i = 0; i < files_.size(); ++i)
+      answer(thid, i, bounds_[thid], bounds_[thid + 1]);
+  }
+
+  // Rows of the k-mer queried and its count in every input, in the
+  // order of the queries
+  void write_tsv(const query_list& list, const std::string& path) const {
+    tsv_writer     out(path);
+    const unsigned nb_inputs = cinfo_.nb_inputs;
+    for(size_t q = 0; q < list.size(); ++q) {
+      out.put(list.at(q), list.k, '\t');
+      out.row(&counts_[q * nb_inputs], nb_inputs);
+    }
+  }
+
+  // Bytes and records read by the passes, not the binary searches
+  void report(run_stats& stats) const {
+    const size_t nb_files   = files_.size();
+    const size_t nb_threads = bounds_.size() - 1;
+    stats.inputs.resize(nb_files);
+    for(size_t i = 0; i < nb_files; ++i) {
+      input_stats& input = stats.inputs[i];
+      input.path         = files_[i].path;
+      input.input        = files_[i].input;
+      input.compressed   = files_[i].compressed();
+      input.bytes_read   = files_[i].bytes_done;
+      input.kmers_read   = 0;
+      for(size_t t = 0; t < nb_threads; ++t)
+        input.kmers_read += records_[t * nb_files + i];
+    }
+  }
+};
+
+template<typename reader_type>
+void query_counts(cpp_array<file_info>& files, const common_info& cinfo, const query_list& queries,
+                  const std::string& path, int nb_threads, run_stats& stats) {
+  std::unique_ptr<query_engine<reader_type> > engine;
+  {
+    phase_timer timer(stats, "sort_queries");
+    engine.reset(new query_engine<reader_type>(files, cinfo, queries, nb_threads));
+  }
+  {
+    phase_timer timer(stats, "query");
+    engine->exec_join(nb_threads);
+  }
+  {
+    phase_timer timer(stats, "write_tsv");
+    engine->write_tsv(queries, path);
+  }
+  engine->report(stats);
+}
+
+template<typename mer_type>
+void query_counts_mer(cpp_array<file_info>& files, const common_info& cinfo, const query_list& queries,
+                      const std::string& path, int nb_threads, run_stats& stats) {
+  if(cinfo.format == binary_dumper::format)
+    query_counts<basic_binary_chunk_reader<mer_type> >(files, cinfo, queries, path, nb_threads, stats);
+  else
+    query_counts<basic_text_chunk_reader<mer_type> >(files, cinfo, queries, path, nb_threads, stats);
+}
+
+// Instantiated for the same k as the merge
+inline void query_counts(cpp_array<file_info>& files, const common_info& cinfo, const query_list& queries,
+                         const std::string& path, int nb_threads, run_stats& stats) {
+  if(cinfo.format != binary_dumper::format && cinfo.format != text_dumper::format)
+    err::die(err::msg() << "Format '" << cinfo.format << "' not supported\n");
+  switch(cinfo.key_len / 2) {
+  case 17: query_counts_mer<static_mer<17> >(files, cinfo, queries, path, nb_threads, stats); break;
+  case 21: query_counts_mer<static_mer<21> >(files, cinfo, queries, path, nb_threads, stats); break;
+  case 25: query_counts_mer<static_mer<25> >(files, cinfo, queries, path, nb_threads, stats); break;
+  case 31: query_counts_mer<static_mer<31> >(files, cinfo, queries, path, nb_threads, stats); break;
+  case 51: query_counts_mer<static_mer<51> >(files, cinfo, queries, path, nb_threads, stats); break;
+  case 63: query_counts_mer<static_mer<63> >(files, cinfo, queries, path, nb_threads, stats); break;
+  default: query_counts_mer<mer_dna>(files, cinfo, queries, path, nb_threads, stats);
+  }
+}
+
+#endif /* __KMER_UTILS_KMER_QUERY_HPP__ */
@@ -0,0 +1,75 @@
+/**
+ * @file   le_writer.hpp
+ *
+ * @brief Buffered writer of little endian unsigned 64 bit integers
+ *
+ * Binary outputs (numpy arrays, partial histograms) are tables of
+ * uint64 written little endian whatever the host, so they read back
+ * the same on any machine.
+ *
+ */
+#ifndef __KMER_UTILS_LE_WRITER_HPP__
+#define __KMER_UTILS_LE_WRITER_HPP__
+
+#include <endian.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "fd_io.hpp"
+
+class le_writer {
+  const int             fd_;
+  std::vector<uint64_t> buffer_;
+  size_t                used_;
+
+  le_writer(const le_writer&);
+  le_writer& operator=(const le_writer&);
+
+public:
+  explicit le_writer(const std::string& path, size_t buffer_size = 1 << 16) :
+    fd_(open_output(path)), buffer_(buffer_size), used_(0)
+  { }
+
+  ~le_writer() {
+    flush();
+    close(fd_);
+  }
+
+  void put(uint64_t x) {
+    if(used_ == buffer_.size())
+      flush();
+    buffer_[used_++] = htole64(x);
+  }
+
+  void put(const uint64_t* xs, size_t n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    flush();
+    write_fully(fd_, (const char*)xs, n * sizeof(uint64_t));
+#else
+    for(size_t i = 0; i < n; ++i)
+      put(xs[i]);
+#endif
+  }
+
+  // Append len raw bytes, e.g. a file header
+  void put_bytes(const char* buf, size_t len) {
+    flush();
+    write_fully(fd_, buf, len);
+  }
+
+  void flush() {
+    write_fully(fd_, (const char*)buffer_.data(), used_ * sizeof(uint64_t));
+    used_ = 0;
+  }
+
+  // Flush and sync to stable storage
+  void sync() {
+    flush();
+    sync_fully(fd_);
+  }
+};
+
+#endif /* __KMER_UTILS_LE_WRITER_HPP__ */
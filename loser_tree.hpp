@@ -0,0 +1,116 @@
+/**
+ * @file   loser_tree.hpp
+ *
+ * @brief Tournament (loser tree) k-way merge of sorted mer iterators
+ *
+ * Replacement for jellyfish::mer_heap::heap in the merge loop. Inputs
+ * are ordered by (hash position, key) as in mer_heap. Every internal
+ * node stores the loser of its match, so advancing the winner costs a
+ * single leaf to root replay of log2(k) comparisons, and keys are
+ * compared in place in the iterators rather than copied into the
+ * tree.
+ *
+ */
+#ifndef __KMER_UTILS_LOSER_TREE_HPP__
+#define __KMER_UTILS_LOSER_TREE_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+template<typename Key, typename Iterator>
+class loser_tree {
+  static const uint64_t done_pos = std::numeric_limits<uint64_t>::max();
+
+  struct leaf_t {
+    Iterator* it_;
+    uint64_t  pos_;
+  };
+
+  const unsigned        k_;
+  std::vector<leaf_t>   leaves_;
+  std::vector<unsigned> losers_;
+  unsigned              winner_;
+  uint64_t              comparisons_; // Matches played, for the run stats
+
+  // Whether leaf a comes strictly before leaf b. Exhausted leaves
+  // come last.
+  bool less(unsigned a, unsigned b) const {
+    const leaf_t& la = leaves_[a];
+    const leaf_t& lb = leaves_[b];
+    if(la.pos_ != lb.pos_)
+      return la.pos_ < lb.pos_;
+    return la.pos_ != done_pos && la.it_->key() < lb.it_->key();
+  }
+
+  void advance(unsigned i) {
+    leaf_t& l = leaves_[i];
+    l.pos_    = l.it_->next() ? l.it_->pos() : done_pos;
+  }
+
+  // Replay the matches from the leaf of the current winner to the root
+  void replay() {
+    unsigned w = winner_;
+    for(unsigned n = (k_ + w) / 2; n > 0; n /= 2) {
+      ++comparisons_;
+      if(less(losers_[n], w)) {
+        const unsigned t = losers_[n];
+        losers_[n]       = w;
+        w                = t;
+      }
+    }
+    winner_ = w;
+  }
+
+public:
+  // Merge the k iterators starting at its. The iterators are primed
+  // (next() is called once on each) by the constructor.
+  loser_tree(Iterator* its, unsigned k) : k_(k), leaves_(k), losers_(k), winner_(0), comparisons_(k - 1) {
+    for(unsigned i = 0; i < k_; ++i) {
+      leaves_[i].it_ = its + i;
+      advance(i);
+    }
+
+    // Play the initial tournament bottom up
+    std::vector<unsigned> winners(2 * k_);
+    for(unsigned i = 0; i < k_; ++i)
+      winners[k_ + i] = i;
+    for(unsigned n = k_ - 1; n > 0; --n) {
+      const unsigned a = winners[2 * n], b = winners[2 * n + 1];
+      if(less(b, a)) {
+        winners[n] = b;
+        losers_[n] = a;
+      } else {
+        winners[n] = a;
+        losers_[n] = b;
+      }
+    }
+    winner_ = k_ > 1 ? winners[1] : 0;
+  }
+
+  uint64_t comparisons() const { return comparisons_; }
+
+  bool is_empty() const { return leaves_[winner_].pos_ == done_pos; }
+  bool is_not_empty() const { return !is_empty(); }
+
+  // Smallest key and hash position among all inputs
+  const Key& key() const { return leaves_[winner_].it_->key(); }
+  uint64_t pos() const { return leaves_[winner_].pos_; }
+
+  // Copy the smallest key into key, the value of that key in each
+  // input into counts (0 for the inputs without it) and advance past
+  // it in every input.
+  void pop(Key& key, uint64_t* counts) {
+    memset(counts, '\0', sizeof(uint64_t) * k_);
+    const uint64_t pos = leaves_[winner_].pos_;
+    key                = leaves_[winner_].it_->key();
+    do {
+      counts[winner_] = leaves_[winner_].it_->val();
+      advance(winner_);
+      replay();
+    } while(leaves_[winner_].pos_ == pos && leaves_[winner_].it_->key() == key);
+  }
+};
+
+#endif /* __KMER_UTILS_LOSER_TREE_HPP__ */
@@ -0,0 +1,57 @@
+/**
+ * @file   mapped_file.hpp
+ *
+ * @brief Read only memory mapping of a whole file
+ *
+ */
+#ifndef __KMER_UTILS_MAPPED_FILE_HPP__
+#define __KMER_UTILS_MAPPED_FILE_HPP__
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <jellyfish/err.hpp>
+
+// Read only, sequentially advised, mapping of a whole file. Empty
+// without a path.
+class mapped_file {
+  char*  base_;
+  size_t size_;
+
+  mapped_file(const mapped_file&);
+  mapped_file& operator=(const mapped_file&);
+
+public:
+  explicit mapped_file(const char* path) : base_(0), size_(0) {
+    if(!path)
+      return;
+    int fd = open(path, O_RDONLY);
+    if(fd == -1)
+      jellyfish::err::die(jellyfish::err::msg() << "Failed to open input file '" << path << "'" << jellyfish::err::no);
+    struct stat st;
+    if(fstat(fd, &st) == -1)
+      jellyfish::err::die(jellyfish::err::msg() << "Failed to stat input file '" << path << "'" << jellyfish::err::no);
+    size_ = st.st_size;
+    if(size_ > 0) {
+      void* ptr = mmap(0, size_, PROT_READ, MAP_SHARED, fd, 0);
+      if(ptr == MAP_FAILED)
+        jellyfish::err::die(jellyfish::err::msg() << "Failed to mmap input file '" << path << "'" << jellyfish::err::no);
+      base_ = (char*)ptr;
+      madvise(base_, size_, MADV_SEQUENTIAL);
+    }
+    close(fd);
+  }
+
+  ~mapped_file() {
+    if(base_)
+      munmap(base_, size_);
+  }
+
+  const char* base() const { return base_; }
+  const char* end() const { return base_ + size_; }
+  size_t size() const { return size_; }
+};
+
+#endif /* __KMER_UTILS_MAPPED_FILE_HPP__ */
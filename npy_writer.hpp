@@ -0,0 +1,45 @@
+/**
+ * @file   npy_writer.hpp
+ *
+ * @brief Writer of numpy .npy files of unsigned 64 bit integers
+ *
+ * Arrays are written in the NPY 1.0 format with dtype '<u8' (little
+ * endian, whatever the host) and C order, so numpy.load, with
+ * mmap_mode='r' if desired, reads them without any parsing.
+ *
+ */
+#ifndef __KMER_UTILS_NPY_WRITER_HPP__
+#define __KMER_UTILS_NPY_WRITER_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "le_writer.hpp"
+
+class npy_writer : public le_writer {
+  // Magic, version 1.0, header length and the header dict, padded
+  // with spaces to a multiple of 64 bytes
+  static std::string header(const std::vector<uint64_t>& shape) {
+    std::string dict = "{'descr': '<u8', 'fortran_order': False, 'shape': (";
+    for(size_t i = 0; i < shape.size(); ++i)
+      dict += std::to_string(shape[i]) + (shape.size() == 1 || i + 1 < shape.size() ? ", " : "");
+    dict += "), }";
+    const size_t prefix_len = 10;
+    dict.append(63 - (prefix_len + dict.size()) % 64, ' ');
+    dict += '\n';
+    std::string res("\x93NUMPY\x01\x00", 8);
+    res += (char)(dict.size() & 0xff);
+    res += (char)(dict.size() >> 8);
+    return res + dict;
+  }
+
+public:
+  // The elements, in C order, must then be put one by one or in bulk
+  npy_writer(const std::string& path, const std::vector<uint64_t>& shape) : le_writer(path) {
+    const std::string h = header(shape);
+    put_bytes(h.data(), h.size());
+  }
+};
+
+#endif /* __KMER_UTILS_NPY_WRITER_HPP__ */
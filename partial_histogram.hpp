@@ -0,0 +1,131 @@
+/**
+ * @file   partial_histogram.hpp
+ *
+ * @brief Binary histograms that can be summed exactly
+ *
+ * A merge of a part of the k-mers (e.g. one cluster job) writes its
+ * histogram as a .khist file; the files of all the parts are summed by
+ * kmer_count_pairs hist-merge into the histogram of the whole merge.
+ *
+ * Format, all little endian uint64 after the magic:
+ *   "KMERHIST" version dims nb_cells
+ *   nb_cells rows of dims counts followed by the number of k-mers
+ *
+ */
+#ifndef __KMER_UTILS_PARTIAL_HISTOGRAM_HPP__
+#define __KMER_UTILS_PARTIAL_HISTOGRAM_HPP__
+
+#include <endian.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <jellyfish/err.hpp>
+
+#include "mapped_file.hpp"
+#include "le_writer.hpp"
+#include "coverage_histogram.hpp"
+#include "joint_histogram.hpp"
+
+static const char     partial_histogram_magic[8] = { 'K', 'M', 'E', 'R', 'H', 'I', 'S', 'T' };
+static const uint64_t partial_histogram_version  = 1;
+
+inline void write_partial_header(le_writer& out, uint64_t dims, uint64_t nb_cells) {
+  out.put_bytes(partial_histogram_magic, sizeof(partial_histogram_magic));
+  out.put(partial_histogram_version);
+  out.put(dims);
+  out.put(nb_cells);
+}
+
+// Append hist to out, e.g. after the state of a checkpoint
+inline void write_partial(const coverage_histogram& hist, le_writer& out) {
+  uint64_t nb_cells = 0;
+  hist.for_each([&](uint64_t, uint64_t, uint64_t) { ++nb_cells; });
+  write_partial_header(out, 2, nb_cells);
+  hist.for_each([&](uint64_t x, uint64_t y, uint64_t n) {
+      out.put(x);
+      out.put(y);
+      out.put(n);
+    });
+}
+
+inline void write_partial(const joint_histogram& hist, le_writer& out) {
+  write_partial_header(out, hist.dims(), hist.size());
+  hist.for_each([&](const uint64_t* counts, uint64_t n) {
+      out.put(counts, hist.dims());
+      out.put(n);
+    });
+}
+
+template<typename histogram_type>
+void write_partial(const histogram_type& hist, const std::string& path) {
+  le_writer out(path);
+  write_partial(hist, out);
+}
+
+// A .khist file, or the histogram at offset of a file, mapped and
+// checked
+class partial_histogram_file {
+  const std::string path_;
+  mapped_file       map_;
+  const size_t      offset_;
+  uint64_t          dims_;
+  uint64_t          nb_cells_;
+
+  uint64_t word(size_t i) const {
+    uint64_t x;
+    memcpy(&x, map_.base() + offset_ + sizeof(partial_histogram_magic) + i * sizeof(uint64_t), sizeof(x));
+    return le64toh(x);
+  }
+
+  void corrupt(const char* what) const {
+    jellyfish::err::die(jellyfish::err::msg() << "Partial histogram '" << path_ << "' " << what);
+  }
+
+public:
+  static const size_t header_words = 3;
+
+  explicit partial_histogram_file(const std::string& path, size_t offset = 0) :
+    path_(path), map_(path.c_str()), offset_(offset)
+  {
+    const size_t header_len = offset + sizeof(partial_histogram_magic) + header_words * sizeof(uint64_t);
+    if(map_.size() < header_len || memcmp(map_.base() + offset, partial_histogram_magic, sizeof(partial_histogram_magic)))
+      corrupt("is not a partial histogram");
+    if(word(0) != partial_histogram_version)
+      corrupt("has an unsupported version");
+    dims_     = word(1);
+    nb_cells_ = word(2);
+    const uint64_t row_len = (dims_ + 1) * sizeof(uint64_t);
+    if(dims_ < 2 || dims_ > 1024 || (map_.size() - header_len) % row_len ||
+       (map_.size() - header_len) / row_len != nb_cells_)
+      corrupt("is truncated or corrupt");
+  }
+
+  const std::string& path() const { return path_; }
+  unsigned dims() const { return dims_; }
+  uint64_t size() const { return nb_cells_; }
+
+  // Call f(counts, n) for every cell
+  template<typename F>
+  void for_each(F f) const {
+    std::vector<uint64_t> counts(dims_);
+    size_t                i = header_words;
+    for(uint64_t c = 0; c < nb_cells_; ++c) {
+      for(unsigned j = 0; j < dims_; ++j)
+        counts[j] = word(i++);
+      f(counts.data(), word(i++));
+    }
+  }
+
+  void add_to(coverage_histogram& hist) const {
+    for_each([&](const uint64_t* counts, uint64_t n) { hist.add(counts[0], counts[1], n); });
+  }
+
+  void add_to(joint_histogram& hist) const {
+    for_each([&](const uint64_t* counts, uint64_t n) { hist.add(counts, n); });
+  }
+};
+
+#endif /* __KMER_UTILS_PARTIAL_HISTOGRAM_HPP__ */
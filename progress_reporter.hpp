@@ -0,0 +1,140 @@
+/**
+ * @file   progress_reporter.hpp
+ *
+ * @brief Periodic report of the merge progress on stderr
+ *
+ * A background thread samples the bytes and k-mers read from every
+ * input, counters the readers update once per chunk or batch of
+ * records, and prints the throughput and an ETA at a fixed interval.
+ * The merge threads are never interrupted.
+ *
+ */
+#ifndef __KMER_UTILS_PROGRESS_REPORTER_HPP__
+#define __KMER_UTILS_PROGRESS_REPORTER_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class progress_reporter {
+public:
+  struct input {
+    std::string                  name;
+    const std::atomic<uint64_t>* bytes_done;
+    const std::atomic<uint64_t>* kmers_done;
+    const std::atomic<uint64_t>* bytes_total; // 0 if unknown: no fraction done (-1) nor ETA
+  };
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  const std::vector<input> inputs_;
+  const double             interval_; // seconds
+  const bool               machine_;
+  const clock::time_point  start_;
+  std::vector<uint64_t>    last_bytes_;
+  uint64_t                 last_kmers_;
+  double                   last_time_;
+  bool                     stop_;
+  std::mutex               mutex_;
+  std::condition_variable  cond_;
+  std::thread              thread_;
+
+  progress_reporter(const progress_reporter&);
+  progress_reporter& operator=(const progress_reporter&);
+
+  void report() {
+    const double now   = std::chrono::duration<double>(clock::now() - start_).count();
+    const double delta = now - last_time_;
+    uint64_t     done = 0, total = 0, kmers = 0;
+    bool         known = true; // Size of every input known
+    std::vector<double> mb_per_s(inputs_.size());
+    for(size_t i = 0; i < inputs_.size(); ++i) {
+      const uint64_t bytes = inputs_[i].bytes_done->load(std::memory_order_relaxed);
+      mb_per_s[i]    = delta > 0 ? (bytes - last_bytes_[i]) / delta / 1e6 : 0;
+      last_bytes_[i] = bytes;
+      done  += bytes;
+      const uint64_t bytes_total = inputs_[i].bytes_total->load(std::memory_order_relaxed);
+      total += bytes_total;
+      known  = known && bytes_total;
+      kmers += inputs_[i].kmers_done->load(std::memory_order_relaxed);
+    }
+    const double kmers_per_s = delta > 0 ? (kmers - last_kmers_) / delta : 0;
+    const double fraction    = !known ? -1 : total ? std::min(1.0, (double)done / total) : 1.0;
+    const double eta         = fraction > 0 ? now * (1 - fraction) / fraction : -1;
+    last_kmers_ = kmers;
+    last_time_  = now;
+
+    // One fprintf per line, so lines of other writers don't interleave
+    std::string line;
+    char        buf[256];
+    if(machine_) {
+      snprintf(buf, sizeof(buf), "PROGRESS\telapsed_s=%.1f\tfraction=%.4f\tkmers=%llu\tkmers_per_s=%.0f\teta_s=%.0f",
+               now, fraction, (unsigned long long)kmers, kmers_per_s, eta);
+      line = buf;
+      for(size_t i = 0; i < inputs_.size(); ++i) {
+        snprintf(buf, sizeof(buf), "\tinput%zu_mb_per_s=%.1f", i, mb_per_s[i]);
+        line += buf;
+      }
+    } else {
+      snprintf(buf, sizeof(buf), "[%.0fs] ", now);
+      line = buf;
+      if(known) {
+        snprintf(buf, sizeof(buf), "%.1f%% ", 100 * fraction);
+        line += buf;
+      }
+      snprintf(buf, sizeof(buf), "%llu k-mers, %.3g k-mers/s", (unsigned long long)kmers, kmers_per_s);
+      line += buf;
+      for(size_t i = 0; i < inputs_.size(); ++i) {
+        snprintf(buf, sizeof(buf), ", %s %.1f MB/s", inputs_[i].name.c_str(), mb_per_s[i]);
+        line += buf;
+      }
+      if(eta >= 0) {
+        const long s = (long)eta;
+        snprintf(buf, sizeof(buf), ", ETA %ld:%02ld:%02ld", s / 3600, (s / 60) % 60, s % 60);
+        line += buf;
+      }
+    }
+    fprintf(stderr, "%s\n", line.c_str());
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!stop_) {
+      if(!cond_.wait_for(lock, std::chrono::duration<double>(interval_), [this]() { return stop_; }))
+        report();
+    }
+  }
+
+public:
+  // Report every interval seconds, as key=value lines if machine
+  progress_reporter(const std::vector<input>& inputs, double interval, bool machine) :
+    inputs_(inputs), interval_(interval), machine_(machine), start_(clock::now()),
+    last_bytes_(inputs.size(), 0), last_kmers_(0), last_time_(0), stop_(false),
+    thread_(&progress_reporter::run, this)
+  { }
+
+  ~progress_reporter() { stop(); }
+
+  // Stop the thread and print a final report
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(stop_)
+        return;
+      stop_ = true;
+    }
+    cond_.notify_one();
+    thread_.join();
+    report();
+  }
+};
+
+#endif /* __KMER_UTILS_PROGRESS_REPORTER_HPP__ */
@@ -0,0 +1,121 @@
+/**
+ * @file   run_stats.hpp
+ *
+ * @brief Timings and counters of a run, written as JSON by --stats
+ *
+ */
+#ifndef __KMER_UTILS_RUN_STATS_HPP__
+#define __KMER_UTILS_RUN_STATS_HPP__
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <jellyfish/err.hpp>
+
+struct input_stats {
+  std::string path;
+  unsigned    input;      // Logical input the file is part of
+  bool        compressed;
+  uint64_t    bytes_read; // Bytes of the file read by the readers of the merge
+  uint64_t    kmers_read;
+};
+
+class run_stats {
+  struct phase {
+    std::string name;
+    double      wall; // seconds
+    double      cpu;  // seconds, user and system, all threads
+  };
+  std::vector<phase> phases_;
+
+  static void write_string(std::ostream& os, const std::string& str) {
+    os << '"';
+    for(char c : str) {
+      if(c == '"' || c == '\\')
+        os << '\\' << c;
+      else if((unsigned char)c < 0x20)
+        os << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xf] << "0123456789abcdef"[c & 0xf];
+      else
+        os << c;
+    }
+    os << '"';
+  }
+
+public:
+  int                      threads;
+  int                      ranges;
+  std::vector<input_stats> inputs;
+  uint64_t                 distinct_kmers;
+  uint64_t                 tree_replays;     // One per record read
+  uint64_t                 tree_comparisons; // Key comparisons counted in the trees
+
+  run_stats() : threads(0), ranges(0), distinct_kmers(0), tree_replays(0), tree_comparisons(0) { }
+
+  static double cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+  }
+
+  static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+  }
+
+  void add_phase(const std::string& name, double wall, double cpu) {
+    const phase p = { name, wall, cpu };
+    phases_.push_back(p);
+  }
+
+  void write_json(const std::string& path) const {
+    std::ofstream os(path.c_str());
+    os << "{\n  \"threads\": " << threads << ",\n  \"ranges\": " << ranges << ",\n  \"phases\": {";
+    for(size_t i = 0; i < phases_.size(); ++i) {
+      os << (i ? ",\n    " : "\n    ");
+      write_string(os, phases_[i].name);
+      os << ": { \"wall_s\": " << phases_[i].wall << ", \"cpu_s\": " << phases_[i].cpu << " }";
+    }
+    os << "\n  },\n  \"inputs\": [";
+    for(size_t i = 0; i < inputs.size(); ++i) {
+      os << (i ? ",\n    " : "\n    ") << "{ \"path\": ";
+      write_string(os, inputs[i].path);
+      os << ", \"input\": " << inputs[i].input << ", \"compressed\": " << (inputs[i].compressed ? "true" : "false")
+         << ", \"bytes_read\": " << inputs[i].bytes_read
+         << ", \"kmers_read\": " << inputs[i].kmers_read << " }";
+    }
+    os << "\n  ],\n  \"distinct_kmers\": " << distinct_kmers
+       << ",\n  \"tree_replays\": " << tree_replays
+       << ",\n  \"tree_comparisons\": " << tree_comparisons
+       << ",\n  \"peak_rss_kb\": " << peak_rss_kb() << "\n}\n";
+    if(!os.good())
+      jellyfish::err::die(jellyfish::err::msg() << "Failed to write stats file '" << path << "'");
+  }
+};
+
+// Adds the wall and CPU time from its construction to its destruction
+// as a phase of stats
+class phase_timer {
+  run_stats&                            stats_;
+  const char*                           name_;
+  std::chrono::steady_clock::time_point wall_;
+  double                                cpu_;
+
+public:
+  phase_timer(run_stats& stats, const char* name) :
+    stats_(stats), name_(name), wall_(std::chrono::steady_clock::now()), cpu_(run_stats::cpu_seconds())
+  { }
+
+  ~phase_timer() {
+    stats_.add_phase(name_, std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_).count(),
+                     run_stats::cpu_seconds() - cpu_);
+  }
+};
+
+#endif /* __KMER_UTILS_RUN_STATS_HPP__ */
@@ -0,0 +1,68 @@
+/**
+ * @file   static_mer.hpp
+ *
+ * @brief k-mer type with k fixed at compile time
+ *
+ * Same word layout as jellyfish::mer_dna (base i from the end in bits
+ * 2(i % 32) of word i / 32), but the words are held inline, so copies
+ * and comparisons of one or two word mers unroll into register
+ * operations instead of loops over a heap allocated array.
+ *
+ */
+#ifndef __KMER_UTILS_STATIC_MER_HPP__
+#define __KMER_UTILS_STATIC_MER_HPP__
+
+#include <cstdint>
+
+#include <jellyfish/err.hpp>
+
+template<unsigned int K>
+class static_mer {
+public:
+  typedef uint64_t base_type;
+  static const unsigned int words = (2 * K + 63) / 64;
+
+private:
+  uint64_t data_[words];
+
+public:
+  static_mer() {
+    for(unsigned int i = 0; i < words; ++i)
+      data_[i] = 0;
+  }
+
+  // Same interface as mer_dna(k)
+  explicit static_mer(unsigned int k) {
+    if(k != K)
+      jellyfish::err::die(jellyfish::err::msg() << "Invalid k " << k << " for a mer of length " << K);
+    for(unsigned int i = 0; i < words; ++i)
+      data_[i] = 0;
+  }
+
+  static unsigned int k() { return K; }
+  static unsigned int nb_words() { return words; }
+  static unsigned int nb_bytes() { return (2 * K + 7) / 8; }
+
+  uint64_t word(unsigned int i) const { return data_[i]; }
+  uint64_t operator[](unsigned int i) const { return data_[i]; }
+  const uint64_t* data() const { return data_; }
+  uint64_t* data__() { return data_; }
+
+  bool operator==(const static_mer& rhs) const {
+    for(unsigned int i = 0; i < words; ++i)
+      if(data_[i] != rhs.data_[i])
+        return false;
+    return true;
+  }
+  bool operator!=(const static_mer& rhs) const { return !(*this == rhs); }
+
+  // Most significant word first, as mer_dna
+  bool operator<(const static_mer& rhs) const {
+    for(unsigned int i = words; i > 0; --i)
+      if(data_[i - 1] != rhs.data_[i - 1])
+        return data_[i - 1] < rhs.data_[i - 1];
+    return false;
+  }
+};
+
+#endif /* __KMER_UTILS_STATIC_MER_HPP__ */
@@ -0,0 +1,187 @@
+/**
+ * @file   text_chunk_reader.hpp
+ *
+ * @brief Read jellyfish text records from a chunk_source
+ *
+ * Drop in replacement for jellyfish::text_reader. Lines are parsed in
+ * place, without istreams or locales: the k bases of a mer are packed
+ * into the 2-bit words of mer_dna 8 bases at a time (SWAR), and the
+ * count is parsed by hand up to the end of the line.
+ *
+ */
+#ifndef __KMER_UTILS_TEXT_CHUNK_READER_HPP__
+#define __KMER_UTILS_TEXT_CHUNK_READER_HPP__
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <jellyfish/err.hpp>
+#include <jellyfish/mer_dna.hpp>
+#include <jellyfish/file_header.hpp>
+#include <jellyfish/rectangular_binary_matrix.hpp>
+
+#include "chunk_source.hpp"
+
+// 2-bit code of a base: A 0, C 1, G 2, T 3, either case. (c >> 1) & 3
+// gives A 0, C 1, G 3, T 2, and the xor swaps G and T.
+inline uint64_t base_code(char c) {
+  const uint64_t x = (c >> 1) & 3;
+  return x ^ (x >> 1);
+}
+
+// Codes of the 8 bases at s, the first one in the high bits
+inline uint64_t pack_8_bases(const char* s) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t x;
+  memcpy(&x, s, sizeof(x));
+  x  = (x >> 1) & 0x0303030303030303ULL;
+  x ^= (x >> 1) & 0x0101010101010101ULL;
+  // Gather the byte codes, earlier bases (lower bytes) to the top
+  x  = ((x << 2) | (x >> 8)) & 0x000F000F000F000FULL;
+  x  = ((x << 4) | (x >> 16)) & 0x000000FF000000FFULL;
+  return ((x << 8) | (x >> 32)) & 0xFFFF;
+#else
+  uint64_t x = 0;
+  for(int i = 0; i < 8; ++i)
+    x = (x << 2) | base_code(s[i]);
+  return x;
+#endif
+}
+
+// Codes of the n <= 32 bases at s, the first one in the high bits
+inline uint64_t pack_bases(const char* s, unsigned int n) {
+  uint64_t     x = 0;
+  unsigned int i = 0;
+  for( ; i + 8 <= n; i += 8)
+    x = (x << 16) | pack_8_bases(s + i);
+  for( ; i < n; ++i)
+    x = (x << 2) | base_code(s[i]);
+  return x;
+}
+
+// Pack the k bases at s into the words of key, a mer_dna or a static_mer
+template<typename mer_type>
+inline void pack_mer(const char* s, unsigned int k, mer_type& key) {
+  uint64_t*    words = key.data__();
+  const int    msw   = key.nb_words() - 1;
+  unsigned int n     = k - 32 * msw; // Bases in the most significant word
+  for(int w = msw; w >= 0; --w, s += n, n = 32)
+    words[w] = pack_bases(s, n);
+}
+
+// Reads the "mer count" lines of a jellyfish text database from the
+// chunks of source, which starts on a line boundary. Lines may span
+// chunks. The dumper writes upper case ACGT only, which is what is
+// decoded; a line of the wrong length is an error. Keys are decoded as
+// mer_type, mer_dna or a static_mer.
+template<typename mer_type>
+class basic_text_chunk_reader {
+  std::unique_ptr<chunk_source>      source_;
+  const char*                        cur_;
+  const char*                        end_;
+  std::vector<char>                  line_; // Line spanning chunks
+  mer_type                           key_;
+  uint64_t                           val_;
+  jellyfish::RectangularBinaryMatrix m_;
+  const size_t                       size_mask_;
+  const unsigned int                 k_;
+
+  static void malformed() {
+    jellyfish::err::die("Malformed line in text database");
+  }
+
+  static bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+  // Parse the line at p, within [p, end). Returns the start of the
+  // next line, or 0 if the line does not end before end.
+  const char* parse(const char* p, const char* end) {
+    if((size_t)(end - p) <= k_)
+      return 0;
+    pack_mer(p, k_, key_);
+    p += k_;
+
+    if(!is_blank(*p))
+      malformed();
+    while(p < end && is_blank(*p))
+      ++p;
+    const char* digits = p;
+    uint64_t    val    = 0;
+    for( ; p < end && (unsigned char)(*p - '0') < 10; ++p)
+      val = val * 10 + (*p - '0');
+    if(p < end && *p == '\r')
+      ++p;
+    if(p == end)
+      return 0;
+    if(p == digits || *p != '\n')
+      malformed();
+    val_ = val;
+    return p + 1;
+  }
+
+  // Parse a line that spans chunks, or starts the next chunk
+  bool next_chunk() {
+    line_.assign(cur_, end_);
+    cur_ = end_;
+    const char *begin, *end;
+    while(source_->next(begin, end)) {
+      if(line_.empty()) {
+        const char* p = parse(begin, end);
+        end_          = end;
+        cur_          = p ? p : end;
+        if(p)
+          return true;
+        line_.assign(begin, end);
+        continue;
+      }
+      const char* eol = (const char*)memchr(begin, '\n', end - begin);
+      line_.insert(line_.end(), begin, eol ? eol + 1 : end);
+      if(!eol)
+        continue;
+      if(!parse(line_.data(), line_.data() + line_.size()))
+        malformed();
+      cur_ = eol + 1;
+      end_ = end;
+      return true;
+    }
+
+    // Last line, possibly without its newline
+    size_t i = 0;
+    while(i < line_.size() && (is_blank(line_[i]) || line_[i] == '\n' || line_[i] == '\r'))
+      ++i;
+    if(i == line_.size())
+      return false;
+    line_.push_back('\n');
+    if(!parse(line_.data(), line_.data() + line_.size()))
+      malformed();
+    line_.clear();
+    return true;
+  }
+
+public:
+  // Takes ownership of source
+  basic_text_chunk_reader(chunk_source* source, jellyfish::file_header* header) :
+    source_(source), cur_(0), end_(0),
+    key_(header->key_len() / 2),
+    val_(0),
+    m_(header->matrix()),
+    size_mask_(header->size() - 1),
+    k_(header->key_len() / 2)
+  { }
+
+  const mer_type& key() const { return key_; }
+  const uint64_t& val() const { return val_; }
+  size_t pos() const { return m_.times(key()) & size_mask_; }
+
+  bool next() {
+    const char* p = cur_ < end_ ? parse(cur_, end_) : 0;
+    if(!p)
+      return next_chunk();
+    cur_ = p;
+    return true;
+  }
+};
+
+typedef basic_text_chunk_reader<jellyfish::mer_dna> text_chunk_reader;
+
+#endif /* __KMER_UTILS_TEXT_CHUNK_READER_HPP__ */
@@ -0,0 +1,107 @@
+/**
+ * @file   tsv_writer.hpp
+ *
+ * @brief Buffered writer of tab separated unsigned integer tables
+ *
+ * Rows are formatted into a large buffer without iostreams or locales
+ * and the buffer is handed to write(2) only when full, so a table
+ * costs a few large writes instead of one flush per line.
+ *
+ */
+#ifndef __KMER_UTILS_TSV_WRITER_HPP__
+#define __KMER_UTILS_TSV_WRITER_HPP__
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fd_io.hpp"
+
+// Decimal representation of x written backward ending at end. Returns
+// the start of the digits.
+inline char* format_uint64(uint64_t x, char* end) {
+  static const char digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  while(x >= 100) {
+    const unsigned i = (x % 100) * 2;
+    x /= 100;
+    *--end = digits[i + 1];
+    *--end = digits[i];
+  }
+  if(x >= 10) {
+    *--end = digits[x * 2 + 1];
+    *--end = digits[x * 2];
+  } else {
+    *--end = '0' + x;
+  }
+  return end;
+}
+
+class tsv_writer {
+  static const size_t max_field = 21; // 20 digits and a separator
+
+  const int         fd_;
+  std::vector<char> buffer_;
+  size_t            used_;
+
+  tsv_writer(const tsv_writer&);
+  tsv_writer& operator=(const tsv_writer&);
+
+public:
+  explicit tsv_writer(const std::string& path, size_t buffer_size = 4 << 20) :
+    fd_(open_output(path)), buffer_(buffer_size), used_(0)
+  { }
+
+  // Takes ownership of fd
+  explicit tsv_writer(int fd, size_t buffer_size = 4 << 20) :
+    fd_(fd), buffer_(buffer_size), used_(0)
+  { }
+
+  ~tsv_writer() {
+    flush();
+    close(fd_);
+  }
+
+  // Append x followed by sep ('\t' or '\n')
+  void put(uint64_t x, char sep) {
+    if(used_ + max_field > buffer_.size())
+      flush();
+    char  tmp[max_field];
+    char* start = format_uint64(x, tmp + max_field - 1);
+    tmp[max_field - 1] = sep;
+    const size_t len = tmp + max_field - start;
+    memcpy(&buffer_[used_], start, len);
+    used_ += len;
+  }
+
+  // Append the len characters of str followed by sep
+  void put(const char* str, size_t len, char sep) {
+    if(used_ + len + 1 > buffer_.size()) {
+      flush();
+      if(len + 1 > buffer_.size())
+        buffer_.resize(len + 1);
+    }
+    memcpy(&buffer_[used_], str, len);
+    buffer_[used_ + len] = sep;
+    used_ += len + 1;
+  }
+
+  // Append a row of n values
+  void row(const uint64_t* values, unsigned n) {
+    for(unsigned i = 0; i + 1 < n; ++i)
+      put(values[i], '\t');
+    put(values[n - 1], '\n');
+  }
+
+  void flush() {
+    write_fully(fd_, buffer_.data(), used_);
+    used_ = 0;
+  }
+};
+
+#endif /* __KMER_UTILS_TSV_WRITER_HPP__ */